@@ -0,0 +1,56 @@
+// Copyright 2022-2024 Antmicro <www.antmicro.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "grabthecam/cameracapture.hpp"
+#include "grabthecam/eventloop.hpp"
+#include "grabthecam/framelease.hpp"
+
+namespace grabthecam
+{
+
+/**
+ * Awaitable frame source for coroutines
+ *
+ * Frames are awaited in the EventLoop instead of blocking a thread per camera:
+ *
+ *     Task<void> process(AsyncCamera &camera)
+ *     {
+ *         FrameLease frame = co_await camera.nextFrame();
+ *     }
+ */
+class AsyncCamera
+{
+public:
+    /**
+     * Constructor
+     *
+     * @param camera Camera in the continuous streaming mode. It must outlive the AsyncCamera object.
+     * @param loop Loop, in which the frames are awaited
+     */
+    AsyncCamera(CameraCapture &camera, EventLoop &loop) : camera(camera), loop(loop) {}
+
+    /**
+     * Wait until the camera has a frame ready and dequeue it
+     *
+     * @return Task returning the lease of the dequeued buffer
+     *
+     * @throws CameraException (when awaited)
+     */
+    Task<FrameLease> nextFrame();
+
+    /**
+     * Returns the wrapped camera
+     *
+     * @return The camera
+     */
+    CameraCapture &getCamera() { return camera; }
+
+private:
+    CameraCapture &camera; ///< Camera to capture from
+    EventLoop &loop;       ///< Loop, in which the frames are awaited
+};
+
+}; // namespace grabthecam
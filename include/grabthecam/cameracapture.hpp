@@ -6,14 +6,24 @@
 
 #include <linux/videodev2.h>
 
+#include "grabthecam/capturestatistics.hpp"
+#include "grabthecam/deviceprofile.hpp"
 #include "grabthecam/frameconverter.hpp"
+#include "grabthecam/framedispatcher.hpp"
+#include "grabthecam/frameinfo.hpp"
+#include "grabthecam/framelease.hpp"
 #include "grabthecam/utils.hpp"
 #include "rapidjson/prettywriter.h"
 #include "rapidjson/stringbuffer.h"
+#include <atomic>
+#include <chrono>
 #include <concepts>
 #include <functional>
+#include <map>
+#include <mutex>
 #include <opencv2/core/mat.hpp> // cv::Mat
 #include <optional>
+#include <span>
 #include <type_traits>
 
 template <typename T>
@@ -37,6 +47,9 @@ struct TriggerInfo
  * Handles capturing frames from v4l cameras
  * Provides C++ API for changing camera settings and capturing frames.
  *
+ * The control table is filled lazily and shared by all callers, so the methods accessing the camera settings lock it
+ * and can be called from several threads.
+ *
  * See how it can be used in src/example.cpp
  */
 class CameraCapture
@@ -88,6 +101,52 @@ public:
         std::vector<CameraPropertyMenuEntry> menuEntries;
     };
 
+    /**
+     * @brief Library used to access the camera (see: CameraCapture)
+     *
+     */
+    enum class Backend
+    {
+        RAW,    ///< Plain open, ioctl and mmap calls. Only the formats native to the camera are available.
+        LIBV4L2 ///< libv4l2, which emulates additional formats by converting and copying every frame in software
+    };
+
+    /**
+     * @brief Format chosen for the requested output (see: chooseFormat)
+     *
+     */
+    struct FormatChoice
+    {
+        uint32_t pixelformat; ///< V4L2_PIX_FMT code
+        uint32_t width = 0;   ///< Frame width in pixels
+        uint32_t height = 0;  ///< Frame height in pixels
+        double fps = 0;       ///< Highest frame rate available for this format and size
+        double cost = 0;      ///< Estimated CPU cost of converting a frame (see: FrameConverter::cost)
+    };
+
+    /**
+     * @brief Format registered for fast switching (see: registerFormatProfile)
+     *
+     */
+    struct FormatProfile
+    {
+        uint32_t width;       ///< Frame width in pixels, as adjusted by the driver
+        uint32_t height;      ///< Frame height in pixels, as adjusted by the driver
+        uint32_t pixelformat; ///< V4L2_PIX_FMT code
+        uint32_t sizeimage;   ///< Size of the frame in this format, in bytes
+    };
+
+    /**
+     * @brief Value of a single control in batched operations (see: setMany, getMany)
+     *
+     */
+    struct ControlValue
+    {
+        uint32_t id;        ///< Ioctl code of the parameter
+        int64_t value;      ///< Value to set, or the value read from the camera
+        int error_code = 0; ///< errno of the failed operation on this control, 0 on success
+    };
+
     /**
      * Returns the trigger information
      *
@@ -114,10 +173,13 @@ public:
      * Open the Camera
      *
      * @param filename Path to the camera file
+     * @param nonblocking Open the camera with O_NONBLOCK. Dequeuing then never blocks inside the driver, so the
+     * camera can be driven from an event loop (see: getFd, tryGrab).
+     * @param backend Library used to access the camera. Use Backend::LIBV4L2 only to capture the formats it emulates.
      *
      * @throws CameraException
      */
-    CameraCapture(std::string filename);
+    CameraCapture(std::string filename, bool nonblocking = false, Backend backend = Backend::RAW);
 
     /**
      * Set camera setting to a given value
@@ -138,6 +200,36 @@ public:
         setCtrl(property, ctrl, warning);
     }
 
+    /**
+     * Set many camera settings at once
+     *
+     * The controls are grouped by their class and each group is set with a single VIDIOC_S_EXT_CTRLS. If the driver
+     * rejects a control, it is marked with the error and the rest of the group is retried without it. After the call
+     * each value holds the value actually set by the driver.
+     *
+     * @param controls Controls with the values to set. The error_code fields are filled in.
+     * @param warning Print warning to stderr when a value was clamped
+     *
+     * @return Number of controls that could not be set
+     *
+     * @throws CameraException
+     */
+    int setMany(std::span<ControlValue> controls, bool warning = true);
+
+    /**
+     * Get many camera settings at once
+     *
+     * The controls are grouped by their class and each group is read with a single VIDIOC_G_EXT_CTRLS (see: setMany).
+     *
+     * @param controls Controls to read. The value and error_code fields are filled in.
+     * @param current Whether to get currently set values. If it's set to false, the default values are returned
+     *
+     * @return Number of controls that could not be read
+     *
+     * @throws CameraException
+     */
+    int getMany(std::span<ControlValue> controls, bool current = true) const;
+
     /**
      * Run ioctl code
      *
@@ -157,15 +249,39 @@ public:
      * @param current Whether to get currently set value. If it's set to false, the default parameter's value is
      * returned
      *
+     * The current values of properties, for which the driver sends control events, are served from memory without
+     * querying the device (see: processControlEvents).
+     *
      * @throws CameraException
      */
     template <numeric T> void get(int property, T &value, bool current = true) const
     {
-        v4l2_ext_controls ctrls;
-        getCtrls(property, current, ctrls);
-        value = ctrls.controls[0].value;
+        std::lock_guard<std::recursive_mutex> lock(control_mutex);
+        int64_t mirrored;
+        if (current && readMirroredValue(property, mirrored))
+        {
+            value = mirrored;
+            return;
+        }
+
+        v4l2_ext_control ctrl;
+        getCtrls(property, current, ctrl);
+        value = ctrl.value;
     }
 
+    /**
+     * Dequeue pending control events and update the control table and the mirrored values
+     *
+     * The events are dequeued automatically before accessing the controls. When the camera is watched in a poll loop,
+     * call it when its file descriptor reports POLLPRI (see: getFd), to see the changes made by other processes as
+     * soon as they happen.
+     *
+     * @return Number of properties whose values changed
+     *
+     * @throws CameraException
+     */
+    int processControlEvents() const;
+
     /**
      * Set the camera frame format to a given value
      * If the dimentons are 0 x 0, only pixel format is changed
@@ -180,10 +296,44 @@ public:
      */
     void setFormat(unsigned int width, unsigned int height, unsigned int pixelformat = 0, bool keep_converter = false);
 
+    /**
+     * Register a format, which can be switched to quickly (see: switchFormat)
+     *
+     * The buffers allocated afterwards are large enough for every registered format, so on drivers which accept
+     * VIDIOC_S_FMT while the buffers are allocated, switching between them does not reallocate the buffers. Drivers
+     * based on videobuf2 (e.g. uvcvideo, vivid) refuse it, so they reallocate the buffers on every switch anyway.
+     * The current format is not changed.
+     *
+     * @param name Name of the profile
+     * @param width Image width in pixels
+     * @param height Image height in pixels
+     * @param pixelformat The pixel format or type of compression
+     *
+     * @throws CameraException if the driver does not accept the format
+     */
+    void registerFormatProfile(const std::string &name, unsigned int width, unsigned int height,
+                               unsigned int pixelformat);
+
+    /**
+     * Switch to the registered format (see: registerFormatProfile)
+     *
+     * If the continuous streaming is active, it is restarted in the new format, on the same buffers if the driver
+     * allows changing the format while they are allocated (see: registerFormatProfile).
+     *
+     * @param name Name of the profile
+     *
+     * @throws CameraException
+     */
+    void switchFormat(const std::string &name);
+
     /**
      * Save configuration to file
      * Save camera parameters to file, so you can load them later.
      *
+     * Only the controls which loadConfig can set back are saved: enabled INTEGER, BOOLEAN, MENU and INTEGER_MENU
+     * controls, which are both readable and writable. Read-only and write-only controls, as well as INTEGER64, BITMASK,
+     * string and compound ones are skipped (use get or printControls to read them).
+     *
      * @param filename Where to save the configuration (by default it's `.pyvidctrl-<driver_name>`)
      *
      * @return Filename where the configuration was saved
@@ -206,13 +356,29 @@ public:
      * Fetch a frame to the buffer
      *
      * @param buffer_no Index of camera buffer where the frame will be fetched. Default = 0
-     * @param number_of_buffers Number of buffers to allocate (if not allocated yet). If this number is not equal to the
+     * @param number_of_buffers Number of buffers to allocate (if not allocated yet). If this number is larger than the
      * number of currently allocated buffers, the stream is restarted and new buffers are allocated.
      * @param locations Vector of pointers to a memory location, where frames should be placed. Its length should be
      * equal to number of buffers. If not provided, the kernel chooses the (page-aligned) addresses at which to create
-     * the mapping. For more information see mmap documentation.
+     * the mapping. For more information see mmap documentation. In the V4L2_MEMORY_USERPTR mode (see: setMemoryType)
+     * the driver captures directly to these locations, so they are required and each has to hold getBufferSize() bytes.
+     *
+     * @return Metadata of the captured frame (sequence number, timestamp, flags...)
+     *
+     * @throws CameraException e.g. if buffer_no is not an index of the allocated buffers
      */
-    void grab(int buffer_no = 0, int number_of_buffers = 1, std::vector<void *> locations = std::vector<void *>());
+    FrameInfo grab(int buffer_no = 0, int number_of_buffers = 1, std::vector<void *> locations = std::vector<void *>());
+
+    /**
+     * Return metadata of the last frame captured to the buffer
+     *
+     * @param buffer_no Index of camera buffer. Default = 0
+     *
+     * @return Frame metadata (sequence number, timestamp, flags...)
+     *
+     * @throws CameraException
+     */
+    FrameInfo getFrameInfo(int buffer_no = 0) const;
 
     /**
      * Return raw frame data
@@ -253,17 +419,311 @@ public:
      * WARNING: You shouldn't provide the type other than provided in converter, when the object has one. (If in doubt,
      * leave it with the default value -1)
      * @param buffer_no Index of camera buffer from  where the frame will be fetched. Default = 0
-     * @param number_of_buffers Number of buffers to allocate (if not allocated yet). If this number is not equal to the
+     * @param number_of_buffers Number of buffers to allocate (if not allocated yet). If this number is larger than the
      * number of currently allocated buffers, the stream is restarted and new buffers are allocated.
      * @param locations Vector of pointers to a memory location, where frames should be placed. Its length should be
      * equal to number of buffers. If not provided, the kernel chooses the (page-aligned) addresses at which to create
-     * the mapping. For more information see mmap documentation.
+     * the mapping. For more information see mmap documentation. In the V4L2_MEMORY_USERPTR mode (see: setMemoryType)
+     * the driver captures directly to these locations, so they are required and each has to hold getBufferSize() bytes.
      *
-     * @return Captured (and preprocessed) frame
+     * @return Captured (and preprocessed) frame. Its metadata can be read with getFrameInfo(buffer_no).
      */
     cv::Mat capture(int raw_frame_dtype = -1, int buffer_no = 0, int number_of_buffers = 1,
                     std::vector<void *> locations = std::vector<void *>());
 
+    /**
+     * Capture a burst of consecutive frames (and preprocess them)
+     *
+     * All buffers are queued in the driver, so the sensor runs at its native frame rate for the whole burst. The raw
+     * frames are copied to preallocated matrices as soon as they are dequeued and converted in parallel once the burst
+     * is complete. If the sequence numbers show that the driver dropped a frame, the burst starts over.
+     *
+     * If the continuous streaming is active, the burst is taken from it. Otherwise the stream is started and stopped.
+     *
+     * @param n Number of frames to capture
+     * @param raw_frame_dtype OpenCV's primitive datatype of the raw frames (see: capture). If in doubt, leave it with
+     * the default value -1
+     * @param number_of_buffers Number of buffers to allocate if the stream is not active
+     *
+     * @return Captured (and preprocessed) frames in the order of capture
+     *
+     * @throws CameraException
+     */
+    std::vector<cv::Mat> captureBurst(int n, int raw_frame_dtype = -1, int number_of_buffers = 4);
+
+    //------------------------------------------------------------------------------------------------
+    /**
+     * Start continuous streaming
+     *
+     * Allocate the buffers, queue all of them in the driver and start streaming. The driver fills the queued buffers in
+     * the background, so the device can capture at full frame rate while the previous frames are processed. Fetch the
+     * filled buffers with dequeueBuffer and return them to the driver with queueBuffer.
+     *
+     * @param number_of_buffers Number of buffers to allocate. The driver may adjust it, so check getNumberOfBuffers.
+     * @param locations Vector of pointers to a memory location, where frames should be placed. Its length should be
+     * equal to number of buffers. If not provided, the kernel chooses the (page-aligned) addresses at which to create
+     * the mapping. For more information see mmap documentation. In the V4L2_MEMORY_USERPTR mode (see: setMemoryType)
+     * the driver captures directly to these locations, so they are required and each has to hold getBufferSize() bytes.
+     *
+     * @throws CameraException
+     */
+    void startStreaming(int number_of_buffers = 4, std::vector<void *> locations = std::vector<void *>());
+
+    /**
+     * Stop streaming, free the buffers and mark camera as not ready to capture
+     *
+     * @throws CameraException
+     */
+    void stopStreaming();
+
+    /**
+     * Whether the camera is in the continuous streaming mode (see: startStreaming)
+     *
+     * @return true if the continuous streaming is active, false otherwise
+     */
+    bool isStreaming() const { return continuous_streaming; }
+
+    /**
+     * Fetch the next filled buffer in the continuous streaming mode
+     *
+     * Blocks until the driver returns a buffer. The buffer stays in userspace (and is not overwritten) until it is
+     * returned with queueBuffer. Its content can be accessed with read.
+     *
+     * @return Index of the dequeued buffer
+     *
+     * @throws CameraException
+     */
+    int dequeueBuffer();
+
+    /**
+     * Dequeue a filled buffer if the driver has one ready
+     *
+     * Does not wait when the camera is in the non-blocking mode. In the blocking mode, call it only when the camera's
+     * file descriptor is readable (see: getFd, waitForFrame).
+     *
+     * @return Index of the dequeued buffer, or -1 if no buffer is ready
+     *
+     * @throws CameraException
+     */
+    int tryDequeueBuffer();
+
+    /**
+     * Return the buffer to the driver, so it can be filled with a new frame
+     *
+     * @param buffer_no Index of the camera buffer
+     *
+     * @throws CameraException if the buffer is not allocated or the driver rejects it
+     */
+    void queueBuffer(int buffer_no);
+
+    /**
+     * Fetch the next frame in the continuous streaming mode
+     *
+     * Blocks until the driver returns a buffer. The buffer is returned to the driver when the lease is destroyed.
+     *
+     * @return Lease of the dequeued buffer
+     *
+     * @throws CameraException
+     */
+    FrameLease acquireFrame();
+
+    /**
+     * Fetch the newest frame in the continuous streaming mode, skipping the stale ones
+     *
+     * Dequeues all buffers the driver has already filled and returns all but the newest one back to the driver.
+     * Waits only if no frame is ready. This gives the lowest latency without reducing the number of buffers the
+     * driver can capture to.
+     *
+     * @return Lease of the newest dequeued buffer
+     *
+     * @throws CameraException
+     */
+    FrameLease grabLatest();
+
+    /**
+     * Fetch the next frame in the continuous streaming mode, waiting for it at most for the given time
+     *
+     * @param timeout Maximum waiting time. A negative value means no limit.
+     *
+     * @return Lease of the dequeued buffer, or std::nullopt if no frame was captured before the timeout
+     *
+     * @throws CameraException
+     */
+    std::optional<FrameLease> grabFor(std::chrono::milliseconds timeout);
+
+    /**
+     * Fetch the next frame in the continuous streaming mode, if it is already captured
+     *
+     * @return Lease of the dequeued buffer, or std::nullopt if no frame is ready
+     *
+     * @throws CameraException
+     */
+    std::optional<FrameLease> tryGrab() { return grabFor(std::chrono::milliseconds(0)); }
+
+    /**
+     * Wait until the driver has a filled buffer ready to dequeue
+     *
+     * @param timeout Maximum waiting time. A negative value means no limit.
+     *
+     * @return true if a frame is ready, false if the timeout expired
+     *
+     * @throws CameraException
+     */
+    bool waitForFrame(std::chrono::milliseconds timeout) const;
+
+    /**
+     * Set the frame rate of the capture
+     *
+     * The driver chooses the nearest frame interval it supports, so check the returned value. A lower frame rate
+     * allows longer exposure times and reduces the load without dropping frames in userspace. The statistics compare
+     * the measured frame rate with the new one (see: getStatistics).
+     *
+     * @param fps Frames per second
+     *
+     * @return Frame rate actually set by the driver
+     *
+     * @throws CameraException if the camera does not support setting the frame rate or rejects it, e.g. while streaming
+     */
+    double setFrameRate(double fps);
+
+    /**
+     * Returns the frame rate of the capture
+     *
+     * @return Frames per second, or 0 if the driver does not report it
+     */
+    double getFrameRate() const;
+
+    /**
+     * Returns the statistics of the frames captured since the stream was started
+     *
+     * Dropped frames are detected by gaps in the sequence numbers. Driver starvation means that all buffers were in
+     * userspace at once, so the driver had nowhere to capture to – consider more buffers or faster processing.
+     *
+     * @return Copy of the current statistics
+     */
+    CaptureStatistics getStatistics() const;
+
+    /**
+     * Reset the capture statistics
+     */
+    void resetStatistics();
+
+    /**
+     * Returns the DMABUF file descriptor exported for the buffer
+     *
+     * The buffer is exported on the first call. The descriptor is valid until the stream is stopped. It can be passed
+     * to other processes or devices (e.g. encoders) to share frames without copying.
+     *
+     * @param buffer_no Index of the camera buffer
+     *
+     * @return DMABUF file descriptor, or -1 if the driver does not support exporting buffers
+     */
+    int getDmabufFd(int buffer_no) const;
+
+    /**
+     * Set the kind of memory used for the capture buffers
+     *
+     * - V4L2_MEMORY_MMAP (default) – buffers are allocated by the driver and mapped to the process memory
+     * - V4L2_MEMORY_USERPTR – the driver captures directly to the memory provided by the caller in the `locations`
+     *   argument of grab, capture or startStreaming (e.g. huge-page backed memory or a part of a larger batch).
+     *   The memory should be page-aligned and must stay valid until the stream is stopped.
+     * - V4L2_MEMORY_DMABUF – the driver captures to externally allocated DMABUFs (see: importDmabufs)
+     *
+     * Changing the memory type stops the stream.
+     *
+     * @param memory V4L2_MEMORY_* code
+     *
+     * @throws CameraException
+     */
+    void setMemoryType(unsigned int memory);
+
+    /**
+     * Use externally allocated DMABUFs as capture buffers (V4L2_MEMORY_DMABUF mode)
+     *
+     * The DMABUFs can come e.g. from udmabuf or from another device's exporter, so a pool shared by the camera,
+     * encoder and display can be allocated once. Each of them has to hold getBufferSize() bytes and be mappable, so
+     * the frames can also be read by the CPU. The descriptors are duplicated, the caller keeps the ownership of the
+     * passed ones. The number of buffers passed to grab, capture or startStreaming cannot exceed the number of DMABUFs.
+     *
+     * Stops the stream.
+     *
+     * @param dmabuf_fds DMABUF file descriptors
+     *
+     * @throws CameraException
+     */
+    void importDmabufs(std::vector<int> dmabuf_fds);
+
+    /**
+     * Returns the kind of memory used for the capture buffers (see: setMemoryType)
+     *
+     * @return V4L2_MEMORY_* code
+     */
+    unsigned int getMemoryType() const { return memory_type; }
+
+    /**
+     * Choose how the buffers mapped from the driver are prepared (see: BufferOptions)
+     *
+     * By default the buffers are neither zeroed, prefaulted nor locked, so the stream starts quickly and the pages are
+     * faulted in by the first frames. The options apply to the buffers allocated afterwards, so the stream is stopped.
+     *
+     * @param options How the buffers are prepared
+     *
+     * @throws CameraException
+     */
+    void setBufferOptions(BufferOptions options);
+
+    /**
+     * Returns how the buffers mapped from the driver are prepared (see: setBufferOptions)
+     *
+     * @return Buffer options
+     */
+    BufferOptions getBufferOptions() const { return buffer_options; }
+
+    /**
+     * Returns the size of a buffer needed to hold a frame in the current format
+     *
+     * @return Size in bytes
+     */
+    unsigned int getBufferSize() const { return buffer_size; }
+
+    /**
+     * Returns the number of currently allocated buffers
+     *
+     * @return Number of buffers
+     */
+    int getNumberOfBuffers() const { return buffers.size(); }
+
+    /**
+     * Start delivering frames to the callback
+     *
+     * The camera is switched to the continuous streaming mode. Frames are dequeued in a capture thread and passed to
+     * the callback in a separate delivery thread. If the callback does not keep up, up to queue_size frames wait for
+     * it and then the policy decides which frames are dropped.
+     *
+     * @param callback Function called for every frame
+     * @param policy What to do with a new frame when the queue of pending frames is full
+     * @param queue_size Maximum number of frames waiting for the callback. It should be lower than number_of_buffers.
+     * @param number_of_buffers Number of buffers to allocate
+     *
+     * @throws CameraException
+     */
+    void start(FrameCallback callback, BackpressurePolicy policy = BackpressurePolicy::DROP_OLDEST,
+               size_t queue_size = 2, int number_of_buffers = 4);
+
+    /**
+     * Stop delivering frames to the callback (see: start) and stop streaming
+     *
+     * @throws CameraException
+     */
+    void stop();
+
+    /**
+     * Returns the number of frames dropped because the callback did not keep up (see: start)
+     *
+     * @return Number of dropped frames
+     */
+    unsigned long getDroppedFrames() const { return dispatcher ? dispatcher->getDroppedFrames() : 0; }
+
     //------------------------------------------------------------------------------------------------
     /**
      * Sets converter for raw frames
@@ -279,12 +739,51 @@ public:
      */
     bool hasConverter() { return (bool)converter; }
 
+    /**
+     * Returns the converter for raw frames
+     *
+     * @return Converter object, nullptr if not set
+     */
+    std::shared_ptr<FrameConverter> getConverter() const { return converter; }
+
     /**
      * Returns the camera's file descriptor
      *
+     * The descriptor can be added to poll/epoll. It becomes readable (POLLIN) when a filled buffer can be dequeued.
+     *
      * @return Camera file descriptor
      */
-    int getFd() { return fd; }
+    int getFd() const { return fd; }
+
+    /**
+     * Returns the library used to access the camera
+     *
+     * @return Backend chosen when opening the camera
+     */
+    Backend getBackend() const { return backend; }
+
+    /**
+     * Returns the name of the library used to access the camera
+     *
+     * @return "raw" or "libv4l2"
+     */
+    std::string getBackendName() const;
+
+    /**
+     * Check whether the current format is emulated by libv4l2, which converts and copies every frame in software
+     *
+     * @return true if the frames are converted by libv4l2, false if they come directly from the driver
+     *
+     * @throws CameraException
+     */
+    bool isFormatEmulated() const;
+
+    /**
+     * Whether the camera was opened with O_NONBLOCK
+     *
+     * @return true if the camera is in the non-blocking mode, false otherwise
+     */
+    bool isNonBlocking() const { return nonblocking; }
 
     /**
      * Returns current width and height
@@ -339,6 +838,61 @@ public:
      */
     CameraPropertyDetails queryPropertyDetails(int32_t propertyID) const;
 
+    /**
+     * Returns the pixel formats supported by the camera, with their frame sizes
+     *
+     * The formats are enumerated once and kept in memory (see: useProfileCache).
+     *
+     * @return Supported formats
+     *
+     * @throws CameraException
+     */
+    const std::vector<FormatDescription> &getFormats() const;
+
+    /**
+     * Choose the format, which gives the requested output at the lowest CPU cost
+     *
+     * Among the enumerated formats that have a converter (see: formats_info), sizes at least as large as requested and
+     * frame rates at least as high as requested are considered. The cost is the converter's cost per pixel
+     * (see: FrameConverter::cost) times the number of pixels; compressed formats get a penalty for decoding.
+     *
+     * @param width Minimum frame width in pixels
+     * @param height Minimum frame height in pixels
+     * @param fps Minimum frame rate. If 0, any frame rate is accepted.
+     *
+     * @return The cheapest format, or std::nullopt if no format meets the requirements
+     *
+     * @throws CameraException
+     */
+    std::optional<FormatChoice> chooseFormat(unsigned int width, unsigned int height, double fps = 0) const;
+
+    /**
+     * Set the format, which gives the requested output at the lowest CPU cost (see: chooseFormat)
+     *
+     * @param width Minimum frame width in pixels
+     * @param height Minimum frame height in pixels
+     * @param fps Minimum frame rate. If 0, any frame rate is accepted.
+     *
+     * @return The chosen format
+     *
+     * @throws CameraException when no format meets the requirements
+     */
+    FormatChoice setBestFormat(unsigned int width, unsigned int height, double fps = 0);
+
+    /**
+     * Use the device profile cache file to skip probing the camera
+     *
+     * If the file describes this camera (the same driver, driver version, card, bus and capabilities), the control
+     * metadata, menus and formats are read from it. Otherwise the camera is probed and the file is (re)written.
+     *
+     * @param filename Path to the profile file. If empty, ".grabthecam-<driver>-<bus_info>" is used.
+     *
+     * @return true if the profile was loaded from the file, false if the camera was probed
+     *
+     * @throws CameraException
+     */
+    bool useProfileCache(std::string filename = "");
+
     /**
      * Sets the trigger mode for the video device
      *
@@ -377,12 +931,77 @@ public:
 private:
     /**
      * Check if the camera supports the property
+     *
+     * The metadata is read from the control table (see: enumerateControls). Changes of the ranges and flags reported
+     * by the driver through control events are applied to the table.
+     *
      * @param property Property to check
-     * @param query The structure, where the results should be stored. It should be empty.
+     * @param query The structure, where the results should be stored
      *
      * @throws CameraException
      */
-    void queryProperty(int property, v4l2_queryctrl &query) const;
+    void queryProperty(int property, v4l2_query_ext_ctrl &query) const;
+
+    /**
+     * Find the property in the control table. Properties not listed by the driver are queried directly and added.
+     *
+     * @param property Property to find
+     * @param query The structure, where the results should be stored
+     *
+     * @return true if the camera supports the property, false otherwise
+     *
+     * @throws CameraException
+     */
+    bool findControl(int property, v4l2_query_ext_ctrl &query) const;
+
+    /**
+     * Fill the control table with all controls of the camera, if it is not filled yet
+     *
+     * The controls are listed with VIDIOC_QUERY_EXT_CTRL and V4L2_CTRL_FLAG_NEXT_CTRL, so only the existing controls
+     * are queried, regardless of their class.
+     */
+    void enumerateControls() const;
+
+    /**
+     * Subscribe to the control events of the property, if the driver supports them
+     *
+     * @param property Property to watch
+     */
+    void subscribeControlEvents(uint32_t property) const;
+
+    /**
+     * Run a batched VIDIOC_S_EXT_CTRLS or VIDIOC_G_EXT_CTRLS, retrying without the controls rejected by the driver
+     *
+     * @param request VIDIOC_S_EXT_CTRLS or VIDIOC_G_EXT_CTRLS
+     * @param which V4L2_CTRL_WHICH_CUR_VAL or V4L2_CTRL_WHICH_DEF_VAL
+     * @param group Controls to access. Their metadata has to be cached (see: queryProperty).
+     */
+    void runExtCtrls(unsigned long request, uint32_t which, std::vector<ControlValue *> group) const;
+
+    /**
+     * Drop the control table, e.g. after changing the format, which may change the ranges
+     */
+    void invalidateControlCache();
+
+    /**
+     * Read the current value of the property from memory, if the driver reports its changes through control events
+     *
+     * @param property Ioctl code of the parameter
+     * @param value Variable, which will be filled with the value
+     *
+     * @return true if the value is mirrored, false if it has to be read from the device
+     *
+     * @throws CameraException
+     */
+    bool readMirroredValue(int property, int64_t &value) const;
+
+    /**
+     * Update the mirrored value after setting the property
+     *
+     * @param property Ioctl code of the parameter
+     * @param value Value set by the driver
+     */
+    void updateMirroredValue(int property, int64_t value) const;
 
     /*
      * Set camera setting to a given value
@@ -401,11 +1020,11 @@ private:
      * @param property Ioctl code of the parameter
      * @param current Whether to get currently set value. If it's set to false, the default parameter's value is
      * returned
-     * @param ctrls Structure, which will be filled with the parameter's value
+     * @param ctrl Structure, which will be filled with the parameter's value
      *
      * @throws CameraException
      */
-    void getCtrls(int property, bool current, v4l2_ext_controls &ctrls) const;
+    void getCtrls(int property, bool current, v4l2_ext_control &ctrl) const;
 
     /**
      * Get current width and height. Set relevants fields.
@@ -419,9 +1038,25 @@ private:
     /**
      * Try to determine (and set) converter based on pixel format
      *
+     * @param pixelformat V4L2_PIX_FMT code of the format currently set on the camera
+     */
+    void autoSetConverter(unsigned int pixelformat);
+
+    /**
+     * Fill the format table with all formats and frame sizes of the camera, if it is not filled yet
+     *
      * @throws CameraException
      */
-    void autoSetConverter();
+    void enumerateFormats() const;
+
+    /**
+     * Returns the items of the menu control, querying them only once
+     *
+     * @param queryctrl Information about the property
+     *
+     * @return Valid menu items
+     */
+    const std::vector<v4l2_querymenu> &queryMenu(const v4l2_query_ext_ctrl &queryctrl) const;
 
     /*
      * Ask the device for the buffers to capture frames and allocate memory for them
@@ -429,18 +1064,96 @@ private:
      * @param n Number of buffers to allocate
      * @param locations Pointers to a place in memory where frame should be placed. Its length should be equal to n. If
      * not provided, the kernel chooses the (page-aligned) address at which to create the mappings. For more information
-     * see mmap documentation.
+     * see mmap documentation. In the V4L2_MEMORY_USERPTR mode they are the buffers, to which the driver captures.
      *
      * @throws CameraException
      */
     void requestBuffers(int n = 1, std::vector<void *> locations = std::vector<void *>());
 
     /**
-     * Stop streaming, free the buffers and mark camera as not ready to capture
+     * Export the buffer as a DMABUF file descriptor (see: MMapBuffer::dmabuf_fd), unless it already has one
+     *
+     * Exporting is deferred to the first request, so streams which do not share the frames do not pay for it.
+     *
+     * @param buffer Buffer of the current stream, which stores the descriptor
+     * @param buffer_no Index of the camera buffer
+     *
+     * @return DMABUF file descriptor, or -1 if the driver does not support exporting buffers
+     */
+    int exportBuffer(MMapBuffer &buffer, int buffer_no) const;
+
+    /**
+     * Close the camera's file descriptor through the chosen backend
+     */
+    void closeDevice();
+
+    /**
+     * Close the copies of the descriptors passed to importDmabufs
+     */
+    void closeImportedDmabufs();
+
+    /**
+     * Run ioctl through the chosen backend, retrying when it is interrupted by a signal
+     *
+     * @param request Ioctl code to run
+     * @param arg Structure, which will be used in this execution
+     *
+     * @return Result of the ioctl, -1 on error (see errno)
+     */
+    int xioctl(unsigned long request, void *arg) const;
+
+    /**
+     * Query the control with VIDIOC_QUERY_EXT_CTRL, or VIDIOC_QUERYCTRL if the driver does not support it
+     *
+     * @param query Structure with the id (and flags) of the control, filled by the driver
+     *
+     * @return Result of the ioctl, -1 on error (see errno)
+     */
+    int queryExtCtrl(v4l2_query_ext_ctrl *query) const;
+
+    /**
+     * Update the capture statistics with a dequeued frame
+     *
+     * @param info Metadata of the dequeued frame
+     */
+    void updateStatistics(const FrameInfo &info);
+
+    /**
+     * Start streaming on the allocated buffers and mark camera as ready to capture
      *
      * @throws CameraException
      */
-    void stopStreaming();
+    void streamOn();
+
+    /**
+     * Stop streaming, but keep the buffers, so they can be reused in the next stream (see: canReuseBuffers)
+     *
+     * @throws CameraException
+     */
+    void streamOff();
+
+    /**
+     * Check if the allocated buffers can be used for the next stream instead of requesting new ones
+     *
+     * @param number_of_buffers Number of buffers the stream needs
+     * @param locations Locations requested for the buffers
+     *
+     * @return true if the buffers are mapped by the driver, their number matches and they fit the current format
+     */
+    bool canReuseBuffers(int number_of_buffers, const std::vector<void *> &locations) const;
+
+    /**
+     * Create the buffers of the given size with VIDIOC_CREATE_BUFS. If it is not supported, request the buffers
+     * for the current format.
+     *
+     * @param n Number of buffers to create
+     * @param size Size of each buffer in bytes
+     *
+     * @return Number of the buffers allocated by the driver
+     *
+     * @throws CameraException
+     */
+    int createBuffers(int n, unsigned int size);
 
     /**
      * Check if the buffer is available for read
@@ -450,14 +1163,14 @@ private:
     void checkBuffer(int buffer_no) const;
 
     /**
-     * Get control with a given id and add it as an object to a json string
-     *
-     * @param queryctrl A structure to fill with information about the property. The id field should be filled
-     * @param json Stringstream to which the object should be appended.i
+     * Add the control with its value as an object to a json string
      *
-     * @return 0 if the property is valid or disabled, 1 otherwise.
+     * @param queryctrl Information about the property
+     * @param value Current value of the property
+     * @param writer Writer to which the object should be appended
      */
-    int saveControlValue(v4l2_queryctrl &queryctrl, rapidjson::PrettyWriter<rapidjson::StringBuffer> &writer);
+    void saveControlValue(const v4l2_query_ext_ctrl &queryctrl, int64_t value,
+                          rapidjson::PrettyWriter<rapidjson::StringBuffer> &writer) const;
 
     /**
      * Return the default filename for configuration
@@ -466,28 +1179,66 @@ private:
      */
     std::string getConfigFilename();
 
+    /**
+     * Return the default filename for the device profile (see: useProfileCache)
+     *
+     * @param capability Capabilities reported by the camera
+     *
+     * @return ".grabthecam-<driver_name>-<bus_info>"
+     */
+    std::string getProfileFilename(const v4l2_capability &capability) const;
+
     /**
      * Print items for menu controls
      */
-    void enumerateMenu(v4l2_queryctrl &queryctrl) const;
+    void enumerateMenu(const v4l2_query_ext_ctrl &queryctrl) const;
 
     /**
      * Print control's name and current and default value.
      *
-     * @return 0 if the property is valid or disabled, 1 otherwise.
+     * @param queryctrl Information about the property
+     * @param value Current value of the property, or the error of reading it
      */
-    int printControl(v4l2_queryctrl &queryctrl) const;
+    void printControl(const v4l2_query_ext_ctrl &queryctrl, const ControlValue &value) const;
+
+    friend class FrameLease;
 
     int fd;                                           ///< A file descriptor to the opened camera
+    bool nonblocking;                                 ///< If the camera was opened with O_NONBLOCK
+    Backend backend;                                  ///< Library used to access the camera
     int width;                                        ///< Frame width in pixels, currently set on the camera
     int height;                                       ///< Frame width in pixels, currently set on the camera
     int v4l2_format_code = 0;                         ///< V4L2_PIX_FMT code, currently set on the camera
-    bool ready_to_capture;                            ///< If the buffers are allocated and stream is active
-    std::shared_ptr<v4l2_buffer> info_buffer;         ///< Information about the current buffer
+    unsigned int buffer_size = 0;                     ///< Size of the frame in the current format, in bytes
+    bool ready_to_capture;                            ///< If the stream is active
+    std::atomic<bool> continuous_streaming = false;   ///< If all buffers are kept queued (see: startStreaming)
+    std::atomic<int> buffers_queued = 0;              ///< Number of buffers currently owned by the driver
+    std::atomic<unsigned int> stream_generation = 0;  ///< Incremented each time the stream is stopped
     int buffer_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;    ///< Type of the allocated buffer
+    unsigned int memory_type = V4L2_MEMORY_MMAP;      ///< Kind of memory used for the buffers
+    BufferOptions buffer_options;                     ///< How the mapped buffers are prepared
+    std::vector<int> imported_dmabufs;                ///< Copies of the imported buffers in the V4L2_MEMORY_DMABUF mode
+    CaptureStatistics statistics;                     ///< Statistics of the frames captured in the stream
+    std::optional<FrameInfo> last_frame;              ///< Metadata of the previously dequeued frame
+    mutable std::mutex statistics_mutex;              ///< Guards the statistics
+    mutable std::mutex export_mutex;                  ///< Guards exporting the buffers as DMABUFs
+    mutable bool can_export = true;                   ///< False once the driver failed to export a buffer
+    std::unique_ptr<FrameDispatcher> dispatcher;      ///< Delivers frames to the callback (see: start)
     std::vector<std::shared_ptr<MMapBuffer>> buffers; ///< Currently allocated buffers
     std::shared_ptr<FrameConverter> converter;        ///< Converter for raw frames
     std::optional<TriggerInfo> trigger_info;          ///< Information about the external trigger configuration
+
+    mutable std::map<int, v4l2_query_ext_ctrl> control_cache;      ///< Control table, metadata of the properties
+    mutable std::vector<uint32_t> control_ids;                     ///< Properties listed by the driver
+    mutable bool controls_enumerated = false;                      ///< Whether the control table lists all properties
+    mutable std::map<int, int64_t> control_values;                 ///< Current values kept up to date by control events
+    mutable std::map<int, std::vector<v4l2_querymenu>> menu_cache; ///< Items of the queried menu controls
+    mutable std::vector<FormatDescription> formats;                ///< Format table, supported formats and sizes
+    mutable bool formats_enumerated = false;                       ///< Whether the format table is filled
+    mutable std::atomic<bool> control_events = false;              ///< Whether the driver sends control events
+    mutable std::recursive_mutex control_mutex;                    ///< Guards the control table and the values
+    std::map<std::string, FormatProfile> format_profiles;          ///< Formats registered for fast switching
+    unsigned int min_buffer_size = 0;                              ///< Size of the largest registered format
 };
 
 }; // namespace grabthecam
@@ -0,0 +1,91 @@
+// Copyright 2022-2024 Antmicro <www.antmicro.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "grabthecam/framelease.hpp"
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <thread>
+
+namespace grabthecam
+{
+
+class CameraCapture;
+
+/**
+ * Background thread dequeuing frames from the camera in the continuous streaming mode and passing them to a sink
+ *
+ * It is the capturing part shared by CaptureThread and FrameDispatcher, which only decide where the frames go.
+ */
+class CaptureLoop
+{
+public:
+    /**
+     * Function called in the capture thread for every dequeued frame
+     */
+    using FrameSink = std::function<void(FrameLease frame)>;
+
+    /**
+     * Function called in the capture thread with the exception, which stopped it
+     */
+    using ErrorHandler = std::function<void(std::exception_ptr error)>;
+
+    /**
+     * Constructor. Does not start capturing.
+     *
+     * @param camera Camera to capture from. It must outlive the CaptureLoop object.
+     * @param number_of_buffers Number of buffers to allocate in the camera
+     */
+    CaptureLoop(CameraCapture &camera, int number_of_buffers);
+
+    /**
+     * Destructor. Joins the capture thread, but leaves the stream to the owner (see: stop).
+     */
+    ~CaptureLoop();
+
+    /**
+     * Start streaming and spawn the capture thread
+     *
+     * @param sink Function called for every frame
+     * @param on_error Function called when capturing fails. The thread stops afterwards.
+     *
+     * @throws CameraException
+     */
+    void start(FrameSink sink, ErrorHandler on_error);
+
+    /**
+     * Join the capture thread and stop streaming
+     *
+     * @param drop_pending Function destroying the leases held by the owner. It is called after the thread is joined,
+     * so the buffers are returned before the driver takes all of them back.
+     *
+     * @throws CameraException
+     */
+    void stop(std::function<void()> drop_pending);
+
+    /**
+     * Whether the capture thread is running
+     *
+     * @return true if the frames are being captured, false otherwise
+     */
+    bool isRunning() const { return running; }
+
+private:
+    /**
+     * Capture loop run in the background thread
+     *
+     * @param sink Function called for every frame
+     * @param on_error Function called when capturing fails
+     */
+    void run(FrameSink sink, ErrorHandler on_error);
+
+    CameraCapture &camera;             ///< Camera to capture from
+    int number_of_buffers;             ///< Number of buffers to allocate in the camera
+    std::thread thread;                ///< The capture thread
+    std::atomic<bool> running = false; ///< Whether the capture thread should keep running
+};
+
+}; // namespace grabthecam
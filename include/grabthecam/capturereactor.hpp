@@ -0,0 +1,154 @@
+// Copyright 2022-2024 Antmicro <www.antmicro.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "grabthecam/cameracapture.hpp"
+#include "grabthecam/framelease.hpp"
+#include "grabthecam/poller.hpp"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace grabthecam
+{
+
+/**
+ * Event loop driving many cameras with a fixed number of threads
+ *
+ * Cameras are registered in epoll sets and a callback is called for every dequeued frame. Cameras are spread
+ * round-robin over the worker threads; each camera is always handled by the same thread, so its frames are delivered
+ * in order. With no workers, all cameras are handled by a single loop run in the caller's thread (see: run).
+ *
+ * Cameras should be opened in the non-blocking mode and be in the continuous streaming mode before they are added.
+ * Exceptions thrown by a callback are reported and the loop continues. A camera, which fails to dequeue a frame or
+ * its events, is removed from the loop.
+ */
+class CaptureReactor
+{
+public:
+    /**
+     * Function called for every dequeued frame. The buffer goes back to the driver when the lease is destroyed.
+     */
+    using FrameCallback = std::function<void(CameraCapture &camera, FrameLease frame)>;
+
+    /**
+     * Constructor. Creates the event loops.
+     *
+     * @param workers Number of worker threads. If set to 0, the loop has to be run with run or runOnce.
+     *
+     * @throws CameraException
+     */
+    CaptureReactor(unsigned int workers = 0);
+
+    /**
+     * Destructor. Stops the worker threads.
+     */
+    ~CaptureReactor();
+
+    /**
+     * Register a camera
+     *
+     * @param camera Camera in the continuous streaming mode. It must outlive the reactor.
+     * @param callback Function called for every frame of this camera
+     *
+     * @throws CameraException
+     */
+    void add(CameraCapture &camera, FrameCallback callback);
+
+    /**
+     * Spawn the worker threads
+     */
+    void start();
+
+    /**
+     * Stop the worker threads or the loop running in the caller's thread
+     */
+    void stop();
+
+    /**
+     * Run the loop in the caller's thread until stop is called (only when there are no workers)
+     *
+     * @throws CameraException
+     */
+    void run();
+
+    /**
+     * Wait for frames once and dispatch them (only when there are no workers)
+     *
+     * @param timeout Maximum waiting time. A negative value means no limit.
+     *
+     * @return Number of dispatched frames
+     *
+     * @throws CameraException
+     */
+    int runOnce(std::chrono::milliseconds timeout);
+
+private:
+    /**
+     * Camera registered in the loop
+     */
+    struct Source
+    {
+        CameraCapture *camera;  ///< Registered camera
+        FrameCallback callback; ///< Function called for every frame
+    };
+
+    /**
+     * Epoll set with the cameras handled by a single thread
+     */
+    struct Loop
+    {
+        Poller poller;                                ///< Epoll instance with the registered cameras
+        std::vector<std::unique_ptr<Source>> sources; ///< Cameras registered in this loop
+        std::thread thread;                           ///< Worker thread, if any
+    };
+
+    /**
+     * Wait for events in the loop once and dispatch the frames
+     *
+     * @param loop Loop to process
+     * @param timeout Maximum waiting time in milliseconds, -1 means no limit
+     *
+     * @return Number of dispatched frames
+     */
+    int process(Loop &loop, int timeout);
+
+    /**
+     * Dequeue the ready frames of the camera and pass them to the callback
+     *
+     * @param loop Loop in which the camera is registered
+     * @param source The camera
+     * @param events Reported epoll events
+     *
+     * @return Number of dispatched frames
+     */
+    int dispatch(Loop &loop, Source &source, uint32_t events);
+
+    /**
+     * Stop watching the camera, e.g. after it failed
+     *
+     * @param loop Loop in which the camera is registered
+     * @param source The camera
+     */
+    void removeSource(Loop &loop, Source &source);
+
+    /**
+     * Worker thread body
+     *
+     * @param loop Loop handled by the thread
+     */
+    void work(Loop &loop);
+
+    std::vector<std::unique_ptr<Loop>> loops; ///< Event loops, one per worker thread
+    unsigned int workers;                     ///< Number of worker threads
+    unsigned int next_loop = 0;               ///< Loop to which the next camera is assigned
+    std::mutex sources_mutex;                 ///< Guards adding the cameras
+    std::atomic<bool> running = false;        ///< Whether the loops should keep running
+};
+
+}; // namespace grabthecam
@@ -0,0 +1,29 @@
+// Copyright 2022-2024 Antmicro <www.antmicro.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace grabthecam
+{
+
+/**
+ * Running statistics of the captured frames, collected since the stream was started
+ *
+ * They help to size the number of buffers and to check whether the processing keeps up with the sensor.
+ */
+struct CaptureStatistics
+{
+    unsigned long frames_delivered = 0;  ///< frames dequeued from the driver
+    unsigned long frames_dropped = 0;    ///< frames missing in the sequence numbers
+    unsigned long sequence_gaps = 0;     ///< number of places in which the sequence numbers were not consecutive
+    unsigned long error_frames = 0;      ///< frames returned with V4L2_BUF_FLAG_ERROR
+    unsigned long starvation_events = 0; ///< dequeues after which no buffer was left in the driver
+    double measured_fps = 0;             ///< frame rate measured from the kernel timestamps (moving average)
+    double nominal_fps = 0;              ///< frame rate reported by the driver, 0 if unknown
+};
+
+}; // namespace grabthecam
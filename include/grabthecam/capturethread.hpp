@@ -0,0 +1,107 @@
+// Copyright 2022-2024 Antmicro <www.antmicro.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "grabthecam/cameracapture.hpp"
+#include "grabthecam/captureloop.hpp"
+#include "grabthecam/framelease.hpp"
+#include "grabthecam/spscring.hpp"
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <optional>
+
+namespace grabthecam
+{
+
+/**
+ * Background thread dequeuing frames from the camera
+ *
+ * The thread runs the camera in the continuous streaming mode and pushes leases of the dequeued buffers to a bounded
+ * single-producer/single-consumer ring, so capturing and processing can run on separate cores. A frame is dropped only
+ * when the ring is full; its buffer is then queued back in the driver immediately.
+ *
+ * Only one thread may pop the frames.
+ */
+class CaptureThread
+{
+public:
+    /**
+     * Constructor. Does not start capturing.
+     *
+     * @param camera Camera to capture from. It must outlive the CaptureThread object.
+     * @param ring_size Maximum number of frames waiting for the consumer. It should be lower than number_of_buffers,
+     * so the driver always has a buffer to capture to.
+     * @param number_of_buffers Number of buffers to allocate in the camera
+     */
+    CaptureThread(CameraCapture &camera, size_t ring_size = 3, int number_of_buffers = 4);
+
+    /**
+     * Destructor. Stops capturing.
+     */
+    ~CaptureThread();
+
+    /**
+     * Start streaming and spawn the capture thread
+     *
+     * @throws CameraException
+     */
+    void start();
+
+    /**
+     * Stop the capture thread, drop the pending frames and stop streaming
+     *
+     * @throws CameraException
+     */
+    void stop();
+
+    /**
+     * Whether the capture thread is running
+     *
+     * @return true if the frames are being captured, false otherwise
+     */
+    bool isRunning() const { return loop.isRunning(); }
+
+    /**
+     * Take the oldest captured frame without waiting
+     *
+     * @return Lease of the frame, or std::nullopt if no frame is pending
+     *
+     * @throws CameraException if capturing failed in the capture thread
+     */
+    std::optional<FrameLease> tryPop();
+
+    /**
+     * Take the oldest captured frame, waiting for it if necessary
+     *
+     * @param timeout Maximum waiting time
+     *
+     * @return Lease of the frame, or std::nullopt if no frame was captured before the timeout
+     *
+     * @throws CameraException if capturing failed in the capture thread
+     */
+    std::optional<FrameLease> pop(std::chrono::milliseconds timeout);
+
+    /**
+     * Returns the number of frames dropped, because the ring was full
+     *
+     * @return Number of dropped frames
+     */
+    unsigned long getDroppedFrames() const { return dropped_frames; }
+
+private:
+    /**
+     * Rethrow the exception which stopped the capture thread, if any
+     */
+    void checkError();
+
+    SPSCRing<FrameLease> ring;                 ///< Frames waiting for the consumer
+    CaptureLoop loop;                          ///< The capture thread
+    std::atomic<unsigned long> dropped_frames; ///< Number of frames dropped because the ring was full
+    std::exception_ptr error;                  ///< Exception which stopped the capture thread
+    std::atomic<bool> failed = false;          ///< Whether the error was set
+};
+
+}; // namespace grabthecam
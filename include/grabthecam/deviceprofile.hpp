@@ -0,0 +1,70 @@
+// Copyright 2022-2024 Antmicro <www.antmicro.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <linux/videodev2.h>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace grabthecam
+{
+
+/**
+ * Pixel format supported by the camera, with its frame sizes and intervals
+ */
+struct FormatDescription
+{
+    v4l2_fmtdesc format;                                  ///< format as listed by VIDIOC_ENUM_FMT
+    std::vector<v4l2_frmsizeenum> sizes;                  ///< frame sizes as listed by VIDIOC_ENUM_FRAMESIZES
+    std::vector<std::vector<v4l2_frmivalenum>> intervals; ///< frame intervals for each size; for a range of sizes,
+                                                          ///< the intervals of the largest one
+};
+
+/**
+ * Everything learned by probing the camera that does not change between openings: capabilities, formats and controls
+ *
+ * It can be stored in a binary file to skip the probing next time the same camera is opened
+ * (see: CameraCapture::useProfileCache).
+ */
+struct DeviceProfile
+{
+    v4l2_capability capability;                ///< identifies the camera: driver, card, bus and capabilities
+    std::vector<v4l2_query_ext_ctrl> controls; ///< metadata of all controls
+    std::vector<v4l2_querymenu> menus;         ///< items of all menu controls
+    std::vector<FormatDescription> formats;    ///< supported pixel formats with their frame sizes and intervals
+
+    /**
+     * Write the profile to a binary file
+     *
+     * @param filename Where to save the profile
+     *
+     * @throws CameraException
+     */
+    void save(std::string filename) const;
+
+    /**
+     * Read the profile from a binary file, if it describes the given camera
+     *
+     * @param filename Where the profile is saved
+     * @param capability Capabilities reported by the opened camera (VIDIOC_QUERYCAP)
+     *
+     * @return The profile, or std::nullopt if the file does not exist, is corrupted or describes a different camera or
+     * driver version
+     */
+    static std::optional<DeviceProfile> load(std::string filename, const v4l2_capability &capability);
+
+    /**
+     * Check if both capabilities describe the same camera with the same driver
+     *
+     * @param first Capabilities of the first camera
+     * @param second Capabilities of the second camera
+     *
+     * @return true if the driver, its version, the card, the bus and the capabilities match, false otherwise
+     */
+    static bool sameDevice(const v4l2_capability &first, const v4l2_capability &second);
+};
+
+}; // namespace grabthecam
@@ -0,0 +1,227 @@
+// Copyright 2022-2024 Antmicro <www.antmicro.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "grabthecam/poller.hpp"
+#include <atomic>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <map>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace grabthecam
+{
+
+template <typename T> class Task;
+
+/**
+ * Promise state shared by all Task types
+ */
+struct TaskPromiseBase
+{
+    /**
+     * Resumes the awaiting coroutine when the task finishes
+     */
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept { return false; }
+        template <typename P> std::coroutine_handle<> await_suspend(std::coroutine_handle<P> handle) noexcept
+        {
+            std::coroutine_handle<> continuation = handle.promise().continuation;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+
+    std::coroutine_handle<> continuation; ///< Coroutine awaiting the task
+    std::exception_ptr error;             ///< Exception thrown by the task
+};
+
+/**
+ * Promise of a task returning a value
+ */
+template <typename T> struct TaskPromise : TaskPromiseBase
+{
+    Task<T> get_return_object();
+    void return_value(T result) { value.emplace(std::move(result)); }
+
+    std::optional<T> value; ///< Value returned by the task
+};
+
+/**
+ * Promise of a task returning nothing
+ */
+template <> struct TaskPromise<void> : TaskPromiseBase
+{
+    Task<void> get_return_object();
+    void return_void() {}
+};
+
+/**
+ * Lazily started coroutine
+ *
+ * The task starts when it is awaited (or spawned in the EventLoop) and resumes the awaiting coroutine when it
+ * finishes. Exceptions thrown in the task are rethrown in the awaiting coroutine.
+ *
+ * @tparam T Type of the returned value
+ */
+template <typename T = void> class Task
+{
+public:
+    using promise_type = TaskPromise<T>;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+    Task(Task &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    Task &operator=(Task &&other) noexcept
+    {
+        std::swap(handle, other.handle);
+        return *this;
+    }
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+
+    /**
+     * Destructor. Destroys the coroutine frame.
+     */
+    ~Task()
+    {
+        if (handle)
+        {
+            handle.destroy();
+        }
+    }
+
+    /**
+     * Whether the task has finished
+     *
+     * @return true if the task returned or threw an exception, false otherwise
+     */
+    bool done() const { return handle && handle.done(); }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+
+    T await_resume()
+    {
+        if (handle.promise().error)
+        {
+            std::rethrow_exception(handle.promise().error);
+        }
+        if constexpr (!std::is_void_v<T>)
+        {
+            return std::move(*handle.promise().value);
+        }
+    }
+
+private:
+    friend class EventLoop;
+
+    std::coroutine_handle<promise_type> handle; ///< Coroutine frame of the task
+};
+
+template <typename T> Task<T> TaskPromise<T>::get_return_object()
+{
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object()
+{
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+/**
+ * Minimal single-threaded event loop for coroutines waiting on file descriptors
+ *
+ * Spawned tasks run in the thread calling run. They suspend on `co_await loop.readable(fd)` until the descriptor is
+ * readable, e.g. until a camera has a frame ready (see: AsyncCamera).
+ */
+class EventLoop
+{
+public:
+    /**
+     * Awaitable suspending the coroutine until the descriptor is readable
+     */
+    struct ReadableAwaiter
+    {
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { loop.watch(fd, handle); }
+        void await_resume() const noexcept {}
+
+        EventLoop &loop; ///< Loop watching the descriptor
+        int fd;          ///< Awaited descriptor
+    };
+
+    /**
+     * Destructor. Destroys the unfinished tasks.
+     */
+    ~EventLoop();
+
+    /**
+     * Suspend the coroutine until the descriptor is readable
+     *
+     * Only one coroutine can wait for a given descriptor at a time.
+     *
+     * @param fd File descriptor to wait for
+     *
+     * @return Awaitable object
+     */
+    ReadableAwaiter readable(int fd) { return ReadableAwaiter{*this, fd}; }
+
+    /**
+     * Run the task in the loop. It starts when run is called.
+     *
+     * @param task Task to run
+     */
+    void spawn(Task<void> task);
+
+    /**
+     * Run the loop until all spawned tasks finish or stop is called
+     *
+     * @throws Exception thrown by any of the spawned tasks
+     */
+    void run();
+
+    /**
+     * Make run return. Can be called from any thread.
+     */
+    void stop();
+
+private:
+    /**
+     * Resume the coroutine when the descriptor is readable
+     *
+     * @param fd File descriptor to wait for
+     * @param handle Suspended coroutine
+     *
+     * @throws CameraException
+     */
+    void watch(int fd, std::coroutine_handle<> handle);
+
+    /**
+     * Destroy the finished tasks and rethrow their exceptions
+     */
+    void collectFinished();
+
+    Poller poller;                                  ///< Epoll instance with the watched descriptors
+    std::map<int, std::coroutine_handle<>> waiters; ///< Coroutines waiting for the descriptors
+    std::vector<int> registered;                    ///< Descriptors already added to the epoll instance
+    std::deque<std::coroutine_handle<>> ready;      ///< Coroutines to resume
+    std::vector<Task<void>> tasks;                  ///< Spawned tasks
+    std::atomic<bool> running = false;              ///< Whether run should keep going
+};
+
+}; // namespace grabthecam
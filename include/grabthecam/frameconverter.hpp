@@ -43,6 +43,13 @@ public:
      */
     virtual cv::Mat convert(std::shared_ptr<MMapBuffer> src, int src_dtype, int width, int height);
 
+    /**
+     * Estimate the CPU cost of the conversion, used to choose the cheapest format (see: CameraCapture::chooseFormat)
+     *
+     * @return Relative cost per pixel, where 1 is the cost of reordering the channels
+     */
+    virtual double cost() const { return 1.0; }
+
     int input_format; ///< cv::Mat format for the input frame
 };
 
@@ -34,6 +34,13 @@ public:
     }
     cv::Mat convert(cv::Mat src) override;
 
+    /**
+     * The channels are unpacked pixel by pixel, without vectorization
+     *
+     * @return Relative cost per pixel (see: FrameConverter::cost)
+     */
+    double cost() const override { return 4.0; }
+
 private:
     PackedFormatEnum type;
 };
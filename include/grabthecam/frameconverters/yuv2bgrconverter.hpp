@@ -41,6 +41,13 @@ public:
      */
     cv::Mat convert(cv::Mat src) override;
 
+    /**
+     * Color space conversion needs arithmetic on every pixel
+     *
+     * @return Relative cost per pixel (see: FrameConverter::cost)
+     */
+    double cost() const override { return 2.0; }
+
 private:
     int code;          ///< OpenCV's Color space conversion code (see: constructor)
     int dest_mat_type; ///< OpenCV's datatype for destination matrix (see: constructor)
@@ -0,0 +1,118 @@
+// Copyright 2022-2024 Antmicro <www.antmicro.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "grabthecam/captureloop.hpp"
+#include "grabthecam/framelease.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace grabthecam
+{
+
+class CameraCapture;
+
+/**
+ * Function called for every captured frame. The buffer goes back to the driver when the lease is destroyed.
+ */
+using FrameCallback = std::function<void(FrameLease frame)>;
+
+/**
+ * What to do with a new frame when the callback does not keep up and the queue of pending frames is full
+ */
+enum class BackpressurePolicy
+{
+    BLOCK,       ///< stop dequeuing until there is space; the driver drops frames when it runs out of buffers
+    DROP_OLDEST, ///< drop the oldest pending frame, so the callback gets the most recent frames
+    DROP_NEWEST, ///< drop the new frame, so the callback gets the frames in order of capture
+};
+
+/**
+ * Delivers frames from the camera to a callback
+ *
+ * A capture thread dequeues the frames and puts them in a bounded queue, from which a delivery thread passes them to
+ * the callback. When the queue is full, the backpressure policy decides which frame is dropped. Exceptions thrown by
+ * the callback are reported and the delivery continues with the next frame.
+ */
+class FrameDispatcher
+{
+public:
+    /**
+     * Constructor. Does not start capturing.
+     *
+     * @param camera Camera to capture from. It must outlive the FrameDispatcher object.
+     * @param callback Function called for every frame
+     * @param policy What to do when the queue of pending frames is full
+     * @param queue_size Maximum number of frames waiting for the callback
+     * @param number_of_buffers Number of buffers to allocate in the camera
+     */
+    FrameDispatcher(CameraCapture &camera, FrameCallback callback, BackpressurePolicy policy, size_t queue_size,
+                    int number_of_buffers);
+
+    /**
+     * Destructor. Stops capturing.
+     */
+    ~FrameDispatcher();
+
+    /**
+     * Start streaming and spawn the capture and delivery threads
+     *
+     * @throws CameraException
+     */
+    void start();
+
+    /**
+     * Stop the threads, drop the pending frames and stop streaming
+     *
+     * @throws CameraException
+     */
+    void stop();
+
+    /**
+     * Returns the number of frames dropped because of the backpressure
+     *
+     * @return Number of dropped frames
+     */
+    unsigned long getDroppedFrames() const { return dropped_frames; }
+
+private:
+    /**
+     * Put the captured frame in the queue, applying the backpressure policy. Called in the capture thread.
+     *
+     * @param frame Captured frame
+     */
+    void enqueue(FrameLease frame);
+
+    /**
+     * Report the error, which stopped the capture thread, and stop the delivery
+     *
+     * @param error Exception thrown while capturing
+     */
+    void fail(std::exception_ptr error);
+
+    /**
+     * Delivery thread body
+     */
+    void deliver();
+
+    FrameCallback callback;                    ///< Function called for every frame
+    BackpressurePolicy policy;                 ///< What to do when the queue is full
+    size_t queue_size;                         ///< Maximum number of pending frames
+    CaptureLoop loop;                          ///< Thread dequeuing the frames
+    std::deque<FrameLease> pending;            ///< Frames waiting for the callback
+    std::mutex pending_mutex;                  ///< Guards the pending frames
+    std::condition_variable frame_available;   ///< Notified when a frame is added to the queue
+    std::condition_variable space_available;   ///< Notified when a frame is taken from the queue
+    std::thread delivery_thread;               ///< Thread calling the callback
+    std::atomic<bool> running = false;         ///< Whether the threads should keep running
+    std::atomic<unsigned long> dropped_frames; ///< Number of frames dropped because of the backpressure
+};
+
+}; // namespace grabthecam
@@ -0,0 +1,50 @@
+// Copyright 2022-2024 Antmicro <www.antmicro.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <linux/videodev2.h>
+
+namespace grabthecam
+{
+
+/**
+ * Metadata of a captured frame, reported by the driver when the buffer is dequeued
+ */
+struct FrameInfo
+{
+    int index = -1;                        ///< index of the camera buffer holding the frame
+    uint32_t sequence = 0;                 ///< frame sequence number; a gap means that frames were dropped
+    std::chrono::nanoseconds timestamp{0}; ///< kernel timestamp of the frame (see: isMonotonic)
+    uint32_t flags = 0;                    ///< V4L2_BUF_FLAG_* flags of the buffer
+    uint32_t field = 0;                    ///< V4L2_FIELD_* order of the fields in the frame
+    uint32_t bytesused = 0;                ///< bytes used by the frame
+
+    /**
+     * Whether the frame was captured with errors (the data may be corrupted)
+     *
+     * @return true if the driver set V4L2_BUF_FLAG_ERROR, false otherwise
+     */
+    bool hasError() const { return flags & V4L2_BUF_FLAG_ERROR; }
+
+    /**
+     * Whether the timestamp comes from the CLOCK_MONOTONIC clock, the same as std::chrono::steady_clock
+     *
+     * @return true if the timestamp is monotonic, false otherwise
+     */
+    bool isMonotonic() const { return (flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC; }
+
+    /**
+     * Time elapsed since the frame was captured, e.g. to measure the capture-to-processing latency
+     *
+     * Valid only for monotonic timestamps (see: isMonotonic).
+     *
+     * @return Age of the frame
+     */
+    std::chrono::nanoseconds age() const { return std::chrono::steady_clock::now().time_since_epoch() - timestamp; }
+};
+
+}; // namespace grabthecam
@@ -0,0 +1,135 @@
+// Copyright 2022-2024 Antmicro <www.antmicro.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "grabthecam/mmapbuffer.hpp"
+#include <cstdint>
+#include <memory>
+#include <opencv2/core/mat.hpp> // cv::Mat
+#include <span>
+
+namespace grabthecam
+{
+
+class CameraCapture;
+
+/**
+ * Move-only handle to a camera buffer dequeued in the continuous streaming mode
+ *
+ * As long as the lease is alive, the driver does not overwrite the buffer, so its content can be passed to other
+ * threads without copying. When the lease is released or destroyed, the buffer is queued back in the driver.
+ * The lease keeps the buffer mapped, so its data stays readable even if the stream is stopped or the buffers are
+ * reallocated in the meantime. The lease must not outlive the CameraCapture object it comes from.
+ */
+class FrameLease
+{
+public:
+    /**
+     * Constructor. Creates an empty lease, which does not own any buffer.
+     */
+    FrameLease() = default;
+
+    /**
+     * Constructor. Takes the ownership of a dequeued buffer.
+     *
+     * @param camera Camera, from which the buffer was dequeued
+     * @param buffer_no Index of the dequeued camera buffer (see: CameraCapture::dequeueBuffer)
+     */
+    FrameLease(CameraCapture *camera, int buffer_no);
+
+    FrameLease(FrameLease &&other) noexcept;
+    FrameLease &operator=(FrameLease &&other) noexcept;
+    FrameLease(const FrameLease &) = delete;
+    FrameLease &operator=(const FrameLease &) = delete;
+
+    /**
+     * Destructor. Returns the buffer to the driver.
+     */
+    ~FrameLease();
+
+    /**
+     * Return the buffer to the driver before the lease is destroyed
+     *
+     * If the stream was restarted since the buffer was dequeued, the buffer is only dropped.
+     *
+     * @throws CameraException
+     */
+    void release();
+
+    /**
+     * Whether the lease owns a buffer
+     *
+     * @return true if the buffer is owned, false if the lease is empty or released
+     */
+    bool valid() const { return camera != nullptr; }
+
+    /**
+     * Returns the index of the owned camera buffer
+     *
+     * @return Buffer index
+     */
+    int index() const { return buffer_no; }
+
+    /**
+     * Returns the owned buffer
+     *
+     * @return Buffer with the raw frame
+     *
+     * @throws CameraException
+     */
+    std::shared_ptr<MMapBuffer> buffer() const;
+
+    /**
+     * Returns raw frame data without copying
+     *
+     * @return View over the bytes used by the captured frame
+     *
+     * @throws CameraException
+     */
+    std::span<uint8_t> data() const;
+
+    /**
+     * Returns metadata of the frame
+     *
+     * @return Sequence number, timestamp, flags... of the frame
+     *
+     * @throws CameraException
+     */
+    FrameInfo info() const { return buffer()->info; }
+
+    /**
+     * Returns the DMABUF file descriptor of the owned buffer
+     *
+     * It can be passed to other processes or devices (e.g. encoders) to share the frame without copying. The buffer is
+     * exported on the first call. The descriptor is owned by the camera, duplicate it if it has to outlive the stream.
+     *
+     * @return DMABUF file descriptor, or -1 if the driver does not support exporting buffers
+     *
+     * @throws CameraException
+     */
+    int dmabufFd() const;
+
+    /**
+     * Wrap the raw frame in cv::Mat without copying
+     *
+     * @param dtype OpenCV's primitive datatype, in which values in matrix will be stored (see
+     * https://docs.opencv.org/4.x/d1/d1b/group__core__hal__interface.html#ga78c5506f62d99edd7e83aba259250394)
+     *
+     * @return cv::Mat object wrapping the raw frame. It is valid only as long as the lease owns the buffer.
+     *
+     * @throws CameraException
+     */
+    cv::Mat mat(int dtype) const;
+
+private:
+    CameraCapture *camera = nullptr;   ///< Camera owning the buffer, nullptr if the lease is empty
+    int buffer_no = -1;                ///< Index of the owned camera buffer
+    unsigned int generation = 0;       ///< Stream generation, in which the buffer was dequeued
+    std::shared_ptr<MMapBuffer> frame; ///< The owned buffer, kept mapped as long as the lease
+    int rows = 0;                      ///< Number of rows of the frame wrapped in cv::Mat (see: mat)
+    int cols = 0;                      ///< Number of columns of the frame wrapped in cv::Mat (see: mat)
+};
+
+}; // namespace grabthecam
@@ -4,9 +4,23 @@
 
 #pragma once
 
+#include "grabthecam/frameinfo.hpp"
+
 namespace grabthecam
 {
 
+/**
+ * How the memory of a mapped buffer is prepared before the first capture (see: CameraCapture::setBufferOptions)
+ *
+ * Each option moves the cost of the page faults to a different moment, at the price of memory or startup time.
+ */
+struct BufferOptions
+{
+    bool zero = false;     ///< Fill the buffer with zeros. Writes (and faults in) the whole buffer at allocation.
+    bool prefault = false; ///< Populate the page tables at allocation (MAP_POPULATE), so the first frame does not fault
+    bool lock = false;     ///< Lock the buffer in RAM (mlock), so it is never paged out. Limited by RLIMIT_MEMLOCK.
+};
+
 /**
  * Class for managing memory mapping and keeping information about buffer.
  */
@@ -21,17 +35,40 @@ public:
      * @param size Size of the buffer to allocate
      * @param fd Camera file descriptor
      * @param offset Offset in fd. For more information see mmap documentation
+     * @param options How the memory is prepared after mapping
+     * @param libv4l2 Map the memory with v4l2_mmap, so the frames emulated by libv4l2 can be read
+     *
+     * @throws CameraException if the memory cannot be mapped or locked
      */
-    MMapBuffer(void *location, int size, int fd, int offset);
+    MMapBuffer(void *location, int size, int fd, int offset, BufferOptions options = BufferOptions(),
+               bool libv4l2 = false);
 
     /**
-     * Destructor. Unmaps the memory
+     * Constructor. Wraps memory provided by the caller without mapping it (for V4L2_MEMORY_USERPTR buffers).
+     *
+     * @param location Pointer to the memory location, where frame should be placed
+     * @param size Size of the memory
+     */
+    MMapBuffer(void *location, int size);
+
+    /**
+     * Destructor. Unmaps the memory (if it was mapped) and closes the exported DMABUF descriptor
      */
     ~MMapBuffer();
 
     unsigned int bytesused; ///< bytes used by a captured frame
     void *start;            ///< pointer to the memory location, where the buffer starts
     int size;               ///< size of the buffer
+    int dmabuf_fd = -1;     ///< DMABUF file descriptor of the buffer, -1 if it is not exported (yet)
+    bool mapped = true;     ///< whether the memory was mapped by this object
+    bool libv4l2 = false;   ///< whether the memory was mapped with v4l2_mmap
+    FrameInfo info;         ///< metadata of the last frame captured to the buffer
+
+private:
+    /**
+     * Unmap the memory with the function matching the one, which mapped it
+     */
+    void unmap();
 };
 
 }; // namespace grabthecam
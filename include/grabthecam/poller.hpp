@@ -0,0 +1,92 @@
+// Copyright 2022-2024 Antmicro <www.antmicro.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <cstdint>
+#include <sys/epoll.h> // epoll_event
+
+namespace grabthecam
+{
+
+/// Maximum number of events fetched from epoll at once
+#define POLLER_MAX_EVENTS 16
+
+/**
+ * Epoll instance with an eventfd, which interrupts waiting from any thread
+ *
+ * It is the descriptor handling shared by the event loops (see: EventLoop, CaptureReactor).
+ */
+class Poller
+{
+public:
+    /**
+     * Constructor. Creates the epoll instance and registers the wake-up descriptor.
+     *
+     * @throws CameraException
+     */
+    Poller();
+
+    /**
+     * Destructor. Closes the descriptors.
+     */
+    ~Poller();
+
+    Poller(const Poller &) = delete;
+    Poller &operator=(const Poller &) = delete;
+
+    /**
+     * Start watching the descriptor
+     *
+     * @param fd File descriptor to watch
+     * @param events Epoll events to wait for (EPOLLIN, EPOLLPRI...)
+     * @param data Value reported with the events of this descriptor
+     *
+     * @throws CameraException
+     */
+    void add(int fd, uint32_t events, epoll_data_t data);
+
+    /**
+     * Change the events watched on the descriptor, e.g. to rearm an EPOLLONESHOT one
+     *
+     * @param fd Watched file descriptor
+     * @param events Epoll events to wait for
+     * @param data Value reported with the events of this descriptor
+     *
+     * @throws CameraException
+     */
+    void modify(int fd, uint32_t events, epoll_data_t data);
+
+    /**
+     * Stop watching the descriptor. Errors are ignored, e.g. when the descriptor was already closed.
+     *
+     * @param fd Watched file descriptor
+     */
+    void remove(int fd);
+
+    /**
+     * Wait for the events. Wake-ups are consumed and not reported, the caller checks whether to stop.
+     *
+     * @param events Array filled with the reported events
+     * @param timeout Maximum waiting time in milliseconds, -1 means no limit
+     *
+     * @return Number of reported events, 0 after a timeout, a wake-up or a signal
+     *
+     * @throws CameraException
+     */
+    int wait(epoll_event (&events)[POLLER_MAX_EVENTS], int timeout);
+
+    /**
+     * Interrupt waiting. Can be called from any thread.
+     *
+     * @return true on success, false if the wake-up descriptor could not be written (see errno)
+     */
+    bool wake();
+
+private:
+    int epoll_fd = -1; ///< Epoll instance with the watched descriptors
+    int wake_fd = -1;  ///< Eventfd used to interrupt waiting
+};
+
+}; // namespace grabthecam
@@ -0,0 +1,120 @@
+// Copyright 2022-2024 Antmicro <www.antmicro.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <optional>
+#include <semaphore>
+#include <vector>
+
+namespace grabthecam
+{
+
+/**
+ * Bounded lock-free single-producer/single-consumer ring
+ *
+ * Only one thread may push and only one thread may pop at a time. Items are moved in and out of the preallocated
+ * slots, so T has to be default-constructible and move-assignable.
+ *
+ * @tparam T Type of the stored items
+ */
+template <typename T> class SPSCRing
+{
+public:
+    /**
+     * Constructor. Allocates the slots.
+     *
+     * @param capacity Maximum number of items stored in the ring
+     */
+    explicit SPSCRing(size_t capacity) : slots(capacity), items(0) {}
+
+    /**
+     * Add an item to the ring (producer side)
+     *
+     * @param item Item to move into the ring
+     *
+     * @return true if the item was added, false if the ring is full (the item is left untouched)
+     */
+    bool tryPush(T &item)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == slots.size())
+        {
+            return false;
+        }
+
+        slots[h % slots.size()] = std::move(item);
+        head.store(h + 1, std::memory_order_release);
+        items.release();
+        return true;
+    }
+
+    /**
+     * Take the oldest item from the ring without waiting (consumer side)
+     *
+     * @return The item, or std::nullopt if the ring is empty
+     */
+    std::optional<T> tryPop()
+    {
+        if (!items.try_acquire())
+        {
+            return std::nullopt;
+        }
+        return take();
+    }
+
+    /**
+     * Take the oldest item from the ring, waiting for it if the ring is empty (consumer side)
+     *
+     * @param timeout Maximum waiting time
+     *
+     * @return The item, or std::nullopt if nothing was pushed before the timeout
+     */
+    std::optional<T> pop(std::chrono::milliseconds timeout)
+    {
+        if (!items.try_acquire_for(timeout))
+        {
+            return std::nullopt;
+        }
+        return take();
+    }
+
+    /**
+     * Returns the number of items currently stored in the ring
+     *
+     * @return Number of items
+     */
+    size_t size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+
+    /**
+     * Returns the maximum number of items stored in the ring
+     *
+     * @return Capacity of the ring
+     */
+    size_t capacity() const { return slots.size(); }
+
+private:
+    /**
+     * Move out the oldest item. The caller has to make sure it was pushed.
+     *
+     * @return The oldest item
+     */
+    T take()
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        T item = std::move(slots[t % slots.size()]);
+        tail.store(t + 1, std::memory_order_release);
+        return item;
+    }
+
+    std::vector<T> slots;                     ///< Preallocated storage for the items
+    alignas(64) std::atomic<size_t> head = 0; ///< Number of pushed items, written only by the producer
+    alignas(64) std::atomic<size_t> tail = 0; ///< Number of popped items, written only by the consumer
+    std::counting_semaphore<> items;          ///< Number of items available for the consumer
+};
+
+}; // namespace grabthecam
@@ -0,0 +1,30 @@
+// Copyright 2022-2024 Antmicro <www.antmicro.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "grabthecam/asynccamera.hpp"
+
+namespace grabthecam
+{
+
+Task<FrameLease> AsyncCamera::nextFrame()
+{
+    if (!camera.isStreaming())
+    {
+        throw CameraException("nextFrame: the continuous streaming is not active. Call startStreaming first.");
+    }
+
+    while (true)
+    {
+        co_await loop.readable(camera.getFd());
+
+        // The descriptor is readable, so dequeuing does not wait even in the blocking mode
+        int buffer_no = camera.tryDequeueBuffer();
+        if (buffer_no >= 0)
+        {
+            co_return FrameLease(&camera, buffer_no);
+        }
+    }
+}
+
+}; // namespace grabthecam
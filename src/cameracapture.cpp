@@ -9,71 +9,458 @@
 #include <rapidjson/istreamwrapper.h>
 #include <rapidjson/ostreamwrapper.h>
 
+#include <algorithm> // stable_partition
+#include <cmath> // lround
 #include <fcntl.h> // O_RDWR
 #include <fstream> //save config
 #include <iostream>
 #include <libv4l2.h>
+#include <opencv2/core/utility.hpp> // parallel_for_
+#include <poll.h> // poll
 #include <sstream>
 #include <sys/ioctl.h> // ioctl
+#include <unistd.h>    // lseek, close
 #include <vector>
 
 namespace grabthecam
 {
 
-#define CAMERA_CLASS_CONTROLS_END V4L2_CID_CAMERA_CLASS_BASE + 36
+/// How much more expensive it is to decode a compressed frame than to convert a raw one with the same converter
+#define COMPRESSED_FORMAT_PENALTY 10.0
 
-int xioctl(int fd, int request, void *arg)
+/// Denominator of the frame interval passed to the driver, so fractional frame rates (e.g. 29.97) can be set
+#define FRAME_RATE_PRECISION 1000
+
+/// How much more expensive it is to capture a format emulated by libv4l2, which converts and copies every frame
+#define EMULATED_FORMAT_PENALTY 2.0
+
+/// How many times captureBurst starts over because of a dropped frame before giving up
+#define BURST_MAX_RESTARTS 3
+
+bool isAutoControl(uint32_t id)
+{
+    switch (id)
+    {
+    case V4L2_CID_EXPOSURE_AUTO:
+    case V4L2_CID_EXPOSURE_AUTO_PRIORITY:
+    case V4L2_CID_AUTOGAIN:
+    case V4L2_CID_AUTOBRIGHTNESS:
+    case V4L2_CID_AUTO_WHITE_BALANCE:
+    case V4L2_CID_AUTO_N_PRESET_WHITE_BALANCE:
+    case V4L2_CID_HUE_AUTO:
+    case V4L2_CID_FOCUS_AUTO:
+    case V4L2_CID_ISO_SENSITIVITY_AUTO:
+        return true;
+    default:
+        return false;
+    }
+}
+
+unsigned int roundUpToStep(unsigned int value, unsigned int minimum, unsigned int step)
+{
+    if (value <= minimum)
+    {
+        return minimum;
+    }
+    step = std::max(step, 1u);
+    return minimum + (value - minimum + step - 1) / step * step;
+}
+
+int CameraCapture::xioctl(unsigned long request, void *arg) const
 {
     int res;
     do
     {
-        res = ioctl(fd, request, arg);
+        res = backend == Backend::LIBV4L2 ? v4l2_ioctl(fd, request, arg) : ioctl(fd, request, arg);
     } while (-1 == res && EINTR == errno); // A signal was caught
     return res;
 }
 
-CameraCapture::CameraCapture(std::string filename) : converter(nullptr)
+int CameraCapture::queryExtCtrl(v4l2_query_ext_ctrl *query) const
+{
+    int res = xioctl(VIDIOC_QUERY_EXT_CTRL, query);
+    if (res == 0 || errno != ENOTTY)
+    {
+        return res;
+    }
+
+    // Fall back to the legacy query for drivers without the extended control API
+    v4l2_queryctrl legacy;
+    memset(&legacy, 0, sizeof(legacy));
+    legacy.id = query->id & ~V4L2_CTRL_FLAG_NEXT_COMPOUND;
+    res = xioctl(VIDIOC_QUERYCTRL, &legacy);
+    if (res == 0)
+    {
+        memset(query, 0, sizeof(*query));
+        query->id = legacy.id;
+        query->type = legacy.type;
+        memcpy(query->name, legacy.name, sizeof(legacy.name));
+        query->minimum = legacy.minimum;
+        query->maximum = legacy.maximum;
+        query->step = legacy.step;
+        query->default_value = legacy.default_value;
+        query->flags = legacy.flags;
+        query->elems = 1;
+    }
+    return res;
+}
+
+CameraCapture::CameraCapture(std::string filename, bool nonblocking, Backend backend)
+    : nonblocking(nonblocking), backend(backend), converter(nullptr)
 {
     // Open the device
-    fd = v4l2_open(filename.c_str(), O_RDWR);
+    fd = open(filename.c_str(), nonblocking ? O_RDWR | O_NONBLOCK : O_RDWR);
 
     if (fd < 0)
     {
-        throw CameraException("Failed to open the camera");
+        throw CameraException("Failed to open the camera", errno);
+    }
+
+    // libv4l2 lists the emulated formats only when asked to, so they can be chosen like the native ones
+    if (backend == Backend::LIBV4L2 && v4l2_fd_open(fd, V4L2_ENABLE_ENUM_FMT_EMULATION) < 0)
+    {
+        int error_code = errno;
+        close(fd);
+        throw CameraException("Failed to open the camera with libv4l2", error_code);
     }
 
     ready_to_capture = false;
-    updateFormat();
+    try
+    {
+        updateFormat();
+    }
+    catch (...)
+    {
+        closeDevice();
+        throw;
+    }
 }
 
 CameraCapture::~CameraCapture()
 {
+    // stop delivering frames
+    dispatcher.reset();
     // end streaming
     runIoctl(VIDIOC_STREAMOFF, &buffer_type);
-    v4l2_close(fd);
+    // unmap the buffers while libv4l2 still knows the device
+    buffers.clear();
+    closeImportedDmabufs();
+    closeDevice();
+}
+
+void CameraCapture::closeDevice()
+{
+    if (backend == Backend::LIBV4L2)
+    {
+        v4l2_close(fd);
+    }
+    else
+    {
+        close(fd);
+    }
 }
 
 void CameraCapture::stopStreaming()
+{
+    streamOff();
+
+    if (!buffers.empty())
+    {
+        // free buffers
+        requestBuffers(0);
+        buffers.clear();
+    }
+}
+
+void CameraCapture::streamOff()
 {
     if (ready_to_capture)
     {
         // stop streaming
         int type = buffer_type;
-        if (xioctl(fd, VIDIOC_STREAMOFF, &type) < 0)
+        if (xioctl(VIDIOC_STREAMOFF, &type) < 0)
         {
             throw CameraException("Could not end streaming. See errno and VIDEOC_STREAMOFF docs for more information");
         }
 
-        // free buffers
-        requestBuffers(0);
-        buffers.clear();
+        // STREAMOFF returns all buffers to the application, so the leased ones must not be queued again
         ready_to_capture = false;
+        continuous_streaming = false;
+        buffers_queued = 0;
+        stream_generation++;
+    }
+}
+
+bool CameraCapture::canReuseBuffers(int number_of_buffers, const std::vector<void *> &locations) const
+{
+    // Only the driver's buffers are known to stay valid, the memory provided by the caller may not. The driver may have
+    // allocated more buffers than requested, so more are fine.
+    if (memory_type != V4L2_MEMORY_MMAP || !locations.empty() || buffers.size() < (size_t)number_of_buffers)
+    {
+        return false;
+    }
+
+    for (auto &buffer : buffers)
+    {
+        if ((unsigned int)buffer->size < buffer_size)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void CameraCapture::streamOn()
+{
+    if (xioctl(VIDIOC_STREAMON, &buffer_type) < 0)
+    {
+        throw CameraException("Could not start streaming. See errno and VIDEOC_STREAMON docs for more information.",
+                              errno);
+    }
+    ready_to_capture = true;
+    resetStatistics();
+}
+
+void CameraCapture::resetStatistics()
+{
+    double nominal_fps = getFrameRate();
+
+    std::lock_guard<std::mutex> lock(statistics_mutex);
+    statistics = CaptureStatistics();
+    statistics.nominal_fps = nominal_fps;
+    last_frame.reset();
+}
+
+CaptureStatistics CameraCapture::getStatistics() const
+{
+    std::lock_guard<std::mutex> lock(statistics_mutex);
+    return statistics;
+}
+
+double CameraCapture::getFrameRate() const
+{
+    v4l2_streamparm parm = {0};
+    parm.type = buffer_type;
+
+    if (xioctl(VIDIOC_G_PARM, &parm) < 0 || !(parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME) ||
+        parm.parm.capture.timeperframe.numerator == 0)
+    {
+        return 0;
+    }
+    return (double)parm.parm.capture.timeperframe.denominator / parm.parm.capture.timeperframe.numerator;
+}
+
+double CameraCapture::setFrameRate(double fps)
+{
+    if (fps <= 0)
+    {
+        throw CameraException("setFrameRate: the frame rate has to be positive");
+    }
+
+    v4l2_streamparm parm = {0};
+    parm.type = buffer_type;
+    if (xioctl(VIDIOC_G_PARM, &parm) < 0)
+    {
+        throw CameraException("Getting stream parameters failed. See errno and VIDIOC_G_PARM docs for more "
+                              "information.",
+                              errno);
+    }
+    if (!(parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME))
+    {
+        throw CameraException("setFrameRate: the camera does not support setting the frame rate");
+    }
+
+    // The driver picks the nearest supported interval
+    parm.parm.capture.timeperframe.numerator = FRAME_RATE_PRECISION;
+    parm.parm.capture.timeperframe.denominator = std::lround(fps * FRAME_RATE_PRECISION);
+    if (xioctl(VIDIOC_S_PARM, &parm) < 0)
+    {
+        throw CameraException("Setting the frame rate failed. Some drivers reject it while streaming. See errno and "
+                              "VIDIOC_S_PARM docs for more information.",
+                              errno);
+    }
+
+    double nominal_fps = parm.parm.capture.timeperframe.numerator == 0
+                             ? 0
+                             : (double)parm.parm.capture.timeperframe.denominator /
+                                   parm.parm.capture.timeperframe.numerator;
+    std::lock_guard<std::mutex> lock(statistics_mutex);
+    statistics.nominal_fps = nominal_fps;
+    return nominal_fps;
+}
+
+void CameraCapture::updateStatistics(const FrameInfo &info)
+{
+    std::lock_guard<std::mutex> lock(statistics_mutex);
+
+    statistics.frames_delivered++;
+    if (info.hasError())
+    {
+        statistics.error_frames++;
+    }
+    if (continuous_streaming && buffers_queued == 0)
+    {
+        statistics.starvation_events++;
+    }
+
+    if (last_frame.has_value())
+    {
+        // Unsigned arithmetic handles the wrap-around of the sequence counter
+        uint32_t frames = info.sequence - last_frame->sequence;
+        if (frames > 1)
+        {
+            statistics.sequence_gaps++;
+            statistics.frames_dropped += frames - 1;
+        }
+
+        // The interval is divided by the number of frames the sensor produced, so the drops do not lower the rate
+        double interval =
+            frames == 0 ? 0 : std::chrono::duration<double>(info.timestamp - last_frame->timestamp).count() / frames;
+        if (interval > 0)
+        {
+            double fps = 1 / interval;
+            statistics.measured_fps =
+                statistics.measured_fps == 0 ? fps : 0.9 * statistics.measured_fps + 0.1 * fps;
+        }
     }
+    last_frame = info;
+}
+
+void CameraCapture::startStreaming(int number_of_buffers, std::vector<void *> locations)
+{
+    streamOff();
+    if (!canReuseBuffers(number_of_buffers, locations))
+    {
+        requestBuffers(number_of_buffers, locations);
+    }
+
+    // Give all buffers to the driver, so it never runs out of space to capture to
+    for (size_t i = 0; i < buffers.size(); i++)
+    {
+        queueBuffer(i);
+    }
+
+    streamOn();
+    continuous_streaming = true;
+}
+
+void CameraCapture::queueBuffer(int buffer_no)
+{
+    if (buffer_no < 0 || (size_t)buffer_no >= buffers.size())
+    {
+        throw CameraException("Buffer " + std::to_string(buffer_no) + " is not allocated.");
+    }
+
+    v4l2_buffer buffer = {0};
+    buffer.type = buffer_type;
+    buffer.memory = memory_type;
+    buffer.index = buffer_no;
+
+    if (memory_type == V4L2_MEMORY_USERPTR)
+    {
+        buffer.m.userptr = reinterpret_cast<unsigned long>(buffers[buffer_no]->start);
+        buffer.length = buffers[buffer_no]->size;
+    }
+    else if (memory_type == V4L2_MEMORY_DMABUF)
+    {
+        buffer.m.fd = buffers[buffer_no]->dmabuf_fd;
+    }
+
+    if (xioctl(VIDIOC_QBUF, &buffer) < 0)
+    {
+        throw CameraException("Could not queue the buffer. See errno and VIDEOC_QBUF docs for more information.",
+                              errno);
+    }
+    buffers_queued++;
+}
+
+int CameraCapture::tryDequeueBuffer()
+{
+    v4l2_buffer buffer = {0};
+    buffer.type = buffer_type;
+    buffer.memory = memory_type;
+
+    if (xioctl(VIDIOC_DQBUF, &buffer) < 0)
+    {
+        if (errno == EAGAIN)
+        {
+            return -1;
+        }
+        throw CameraException("Could not dequeue the buffer. See errno and VIDEOC_DQBUF docs for more information.",
+                              errno);
+    }
+    buffers_queued--;
+
+    // Frames get written after dequeuing the buffer
+    std::shared_ptr<MMapBuffer> &frame = buffers[buffer.index];
+    frame->bytesused = buffer.bytesused;
+    frame->info.index = buffer.index;
+    frame->info.sequence = buffer.sequence;
+    frame->info.timestamp = std::chrono::seconds(buffer.timestamp.tv_sec) +
+                            std::chrono::microseconds(buffer.timestamp.tv_usec);
+    frame->info.flags = buffer.flags;
+    frame->info.field = buffer.field;
+    frame->info.bytesused = buffer.bytesused;
+    updateStatistics(frame->info);
+    return buffer.index;
+}
+
+int CameraCapture::dequeueBuffer()
+{
+    int buffer_no = tryDequeueBuffer();
+    while (buffer_no < 0)
+    {
+        // In the non-blocking mode the driver returns EAGAIN instead of waiting
+        waitForFrame(std::chrono::milliseconds(-1));
+        buffer_no = tryDequeueBuffer();
+    }
+    return buffer_no;
+}
+
+bool CameraCapture::waitForFrame(std::chrono::milliseconds timeout) const
+{
+    pollfd camera_fd = {.fd = fd, .events = POLLIN};
+    int res;
+    do
+    {
+        res = poll(&camera_fd, 1, timeout.count() < 0 ? -1 : timeout.count());
+    } while (-1 == res && EINTR == errno); // A signal was caught
+
+    if (res < 0)
+    {
+        throw CameraException("Waiting for the frame failed", errno);
+    }
+    if (camera_fd.revents & POLLERR)
+    {
+        throw CameraException("Waiting for the frame failed. Check if the stream is started.");
+    }
+    return res > 0;
+}
+
+std::optional<FrameLease> CameraCapture::grabFor(std::chrono::milliseconds timeout)
+{
+    if (!continuous_streaming)
+    {
+        throw CameraException("grabFor: the continuous streaming is not active. Call startStreaming first.");
+    }
+
+    if (!waitForFrame(timeout))
+    {
+        return std::nullopt;
+    }
+
+    int buffer_no = tryDequeueBuffer();
+    if (buffer_no < 0)
+    {
+        return std::nullopt;
+    }
+    return FrameLease(this, buffer_no);
 }
 
 void CameraCapture::setFormat(unsigned int width, unsigned int height, unsigned int pixelformat, bool keep_converter)
 {
-    stopStreaming();
+    // Keep the buffers, they are reused if they are large enough for the new format
+    streamOff();
 
     // Set Image format
     v4l2_format fmt = {0};
@@ -93,26 +480,72 @@ void CameraCapture::setFormat(unsigned int width, unsigned int height, unsigned
     }
 
     fmt.fmt.pix.field = V4L2_FIELD_NONE;
-    if (xioctl(fd, VIDIOC_S_FMT, &fmt) < 0)
+    int result = xioctl(VIDIOC_S_FMT, &fmt);
+    if (result < 0 && errno == EBUSY && !buffers.empty())
+    {
+        // Drivers based on videobuf2 refuse to change the format while any buffers are allocated
+        stopStreaming();
+        result = xioctl(VIDIOC_S_FMT, &fmt);
+    }
+
+    if (result < 0)
     {
         throw CameraException("Setting format failed. See errno and VIDEOC_S_FMT docs for more information");
     }
     else
     {
+        // The frames in the kept buffers are in the previous format
+        for (auto &buffer : buffers)
+        {
+            buffer->bytesused = 0;
+        }
         updateFormat(keep_converter);
     }
 }
 
-void CameraCapture::autoSetConverter()
+void CameraCapture::registerFormatProfile(const std::string &name, unsigned int width, unsigned int height,
+                                          unsigned int pixelformat)
 {
+    // Ask the driver how it would adjust the format, without changing the current one
     v4l2_format fmt = {0};
+
     fmt.type = buffer_type;
-    if (xioctl(fd, VIDIOC_G_FMT, &fmt) < 0)
+    fmt.fmt.pix.width = width;
+    fmt.fmt.pix.height = height;
+    fmt.fmt.pix.pixelformat = pixelformat;
+    fmt.fmt.pix.field = V4L2_FIELD_NONE;
+
+    if (xioctl(VIDIOC_TRY_FMT, &fmt) < 0)
     {
-        throw CameraException("Getting format failed. See errno and VIDEOC_G_FMT docs for more information");
+        throw CameraException("Trying format failed. See errno and VIDEOC_TRY_FMT docs for more information", errno);
+    }
+
+    format_profiles[name] = {fmt.fmt.pix.width, fmt.fmt.pix.height, fmt.fmt.pix.pixelformat, fmt.fmt.pix.sizeimage};
+    min_buffer_size = std::max(min_buffer_size, fmt.fmt.pix.sizeimage);
+}
+
+void CameraCapture::switchFormat(const std::string &name)
+{
+    auto profile = format_profiles.find(name);
+    if (profile == format_profiles.end())
+    {
+        throw CameraException("Unknown format profile " + name);
+    }
+
+    bool was_streaming = continuous_streaming;
+    int number_of_buffers = buffers.size();
+
+    setFormat(profile->second.width, profile->second.height, profile->second.pixelformat);
+
+    if (was_streaming)
+    {
+        // The kept buffers fit the profile, so they are only queued again before STREAMON
+        startStreaming(number_of_buffers);
     }
+}
 
-    unsigned int pixelformat = fmt.fmt.pix.pixelformat;
+void CameraCapture::autoSetConverter(unsigned int pixelformat)
+{
     try
     {
         setConverter(formats_info.at(pixelformat)());
@@ -129,64 +562,382 @@ void CameraCapture::updateFormat(bool keep_converter)
     v4l2_format fmt = {0};
     fmt.type = buffer_type;
 
-    if (xioctl(fd, VIDIOC_G_FMT, &fmt) < 0)
+    if (xioctl(VIDIOC_G_FMT, &fmt) < 0)
     {
         throw CameraException("Getting format failed. See errno and VIDEOC_G_FMT docs for more information");
     }
 
     height = fmt.fmt.pix.height;
     width = fmt.fmt.pix.width;
+    buffer_size = fmt.fmt.pix.sizeimage;
+
+    // The ranges of some properties depend on the format. Without control events the cache would not notice.
+    if (!control_events)
+    {
+        invalidateControlCache();
+    }
     if (!keep_converter)
     {
-        autoSetConverter();
+        autoSetConverter(fmt.fmt.pix.pixelformat);
     }
     this->v4l2_format_code = fmt.fmt.pix.pixelformat;
 }
 
 void CameraCapture::runIoctl(int ioctl, void *value) const
 {
-    if (v4l2_ioctl(fd, ioctl, value) != 0)
+    if (xioctl(ioctl, value) != 0)
     {
-        throw CameraException("runIoctl: v4l2_ioctl error [ioctl: " + std::to_string(ioctl) + "]", errno);
+        throw CameraException("runIoctl: ioctl error [ioctl: " + std::to_string(ioctl) + "]", errno);
     }
 }
 
-void CameraCapture::queryProperty(int property, v4l2_queryctrl &query) const
+void CameraCapture::queryProperty(int property, v4l2_query_ext_ctrl &query) const
 {
+    std::lock_guard<std::recursive_mutex> lock(control_mutex);
+    if (!findControl(property, query))
+    {
+        throw CameraException("queryProperty: vidioc_queryctrl error: Property is not supported.", EINVAL);
+    }
+    if (query.flags & V4L2_CTRL_FLAG_DISABLED)
+    {
+        throw CameraException("queryProperty: vidioc_queryctrl error: Property is disabled.");
+    }
+}
+
+bool CameraCapture::findControl(int property, v4l2_query_ext_ctrl &query) const
+{
+    std::lock_guard<std::recursive_mutex> lock(control_mutex);
+    enumerateControls();
+    processControlEvents();
+
+    auto cached = control_cache.find(property);
+    if (cached != control_cache.end())
+    {
+        query = cached->second;
+        return true;
+    }
+
+    // Some drivers do not list all controls, e.g. the old private ones, so ask for it directly
     memset(&query, 0, sizeof(query));
     query.id = property;
-
-    if (xioctl(fd, VIDIOC_QUERYCTRL, &query) == -1)
+    if (queryExtCtrl(&query) == -1)
     {
         if (errno != EINVAL)
         {
             throw CameraException("queryProperty: vidioc_queryctrl error", errno);
         }
+        return false;
+    }
+    control_cache[property] = query;
+    subscribeControlEvents(property);
+    return true;
+}
+
+void CameraCapture::enumerateControls() const
+{
+    if (controls_enumerated)
+    {
+        return;
+    }
+
+    v4l2_query_ext_ctrl query;
+    memset(&query, 0, sizeof(query));
+    query.id = V4L2_CTRL_FLAG_NEXT_CTRL | V4L2_CTRL_FLAG_NEXT_COMPOUND;
+    while (queryExtCtrl(&query) == 0)
+    {
+        // Class entries only group the controls
+        if (query.type != V4L2_CTRL_TYPE_CTRL_CLASS)
+        {
+            control_ids.push_back(query.id);
+            control_cache[query.id] = query;
+            subscribeControlEvents(query.id);
+        }
+
+        uint32_t next = query.id | V4L2_CTRL_FLAG_NEXT_CTRL | V4L2_CTRL_FLAG_NEXT_COMPOUND;
+        memset(&query, 0, sizeof(query));
+        query.id = next;
+    }
+    controls_enumerated = true;
+}
+
+void CameraCapture::subscribeControlEvents(uint32_t property) const
+{
+    // Get notified when the value, range or flags of the property change. The initial event carries the current value.
+    v4l2_event_subscription subscription = {0};
+    subscription.type = V4L2_EVENT_CTRL;
+    subscription.id = property;
+    subscription.flags = V4L2_EVENT_SUB_FL_SEND_INITIAL;
+    if (xioctl(VIDIOC_SUBSCRIBE_EVENT, &subscription) == 0)
+    {
+        control_events = true;
+    }
+}
+
+int CameraCapture::setMany(std::span<ControlValue> controls, bool warning)
+{
+    std::lock_guard<std::recursive_mutex> lock(control_mutex);
+    std::map<uint32_t, std::vector<ControlValue *>> groups;
+    std::vector<int64_t> requested;
+    int failed = 0;
+    for (ControlValue &control : controls)
+    {
+        requested.push_back(control.value);
+        try
+        {
+            v4l2_query_ext_ctrl queryctrl;
+            queryProperty(control.id, queryctrl);
+            control.error_code = 0;
+            groups[V4L2_CTRL_ID2WHICH(control.id)].push_back(&control);
+        }
+        catch (CameraException e)
+        {
+            control.error_code = e.error_code != 0 ? e.error_code : EINVAL;
+        }
+    }
+
+    for (auto &[control_class, group] : groups)
+    {
+        runExtCtrls(VIDIOC_S_EXT_CTRLS, V4L2_CTRL_WHICH_CUR_VAL, group);
+    }
+
+    for (size_t i = 0; i < controls.size(); i++)
+    {
+        if (controls[i].error_code != 0)
+        {
+            failed++;
+            continue;
+        }
+        updateMirroredValue(controls[i].id, controls[i].value);
+        if (warning && controls[i].value != requested[i])
+        {
+            const v4l2_query_ext_ctrl &queryctrl = control_cache.at(controls[i].id);
+            std::cerr << "\n[WARNING] " << queryctrl.name << " value was clamped to " << controls[i].value
+                      << ". It should be between " + std::to_string(queryctrl.minimum) + " and " +
+                             std::to_string(queryctrl.maximum) + " (step: " + std::to_string(queryctrl.step) + ")\n";
+        }
+    }
+    return failed;
+}
+
+int CameraCapture::getMany(std::span<ControlValue> controls, bool current) const
+{
+    std::lock_guard<std::recursive_mutex> lock(control_mutex);
+    std::map<uint32_t, std::vector<ControlValue *>> groups;
+    int failed = 0;
+    for (ControlValue &control : controls)
+    {
+        try
+        {
+            v4l2_query_ext_ctrl queryctrl;
+            queryProperty(control.id, queryctrl);
+            control.error_code = 0;
+            if (!(current && readMirroredValue(control.id, control.value)))
+            {
+                groups[V4L2_CTRL_ID2WHICH(control.id)].push_back(&control);
+            }
+        }
+        catch (CameraException e)
+        {
+            control.error_code = e.error_code != 0 ? e.error_code : EINVAL;
+        }
+    }
+
+    for (auto &[control_class, group] : groups)
+    {
+        runExtCtrls(VIDIOC_G_EXT_CTRLS, current ? V4L2_CTRL_WHICH_CUR_VAL : V4L2_CTRL_WHICH_DEF_VAL, group);
+    }
+
+    for (const ControlValue &control : controls)
+    {
+        if (control.error_code != 0)
+        {
+            failed++;
+        }
+    }
+    return failed;
+}
+
+void CameraCapture::runExtCtrls(unsigned long request, uint32_t which, std::vector<ControlValue *> group) const
+{
+    while (!group.empty())
+    {
+        std::vector<v4l2_ext_control> ctrl(group.size());
+        for (size_t i = 0; i < group.size(); i++)
+        {
+            ctrl[i].id = group[i]->id;
+            if (control_cache.at(group[i]->id).type == V4L2_CTRL_TYPE_INTEGER64)
+            {
+                ctrl[i].value64 = group[i]->value;
+            }
+            else
+            {
+                ctrl[i].value = group[i]->value;
+            }
+        }
+
+        v4l2_ext_controls ctrls;
+        memset(&ctrls, 0, sizeof(ctrls));
+        ctrls.which = which;
+        ctrls.count = ctrl.size();
+        ctrls.controls = ctrl.data();
+
+        if (xioctl(request, &ctrls) == 0)
+        {
+            for (size_t i = 0; i < group.size(); i++)
+            {
+                bool is_64bit = control_cache.at(group[i]->id).type == V4L2_CTRL_TYPE_INTEGER64;
+                group[i]->value = is_64bit ? ctrl[i].value64 : ctrl[i].value;
+            }
+            return;
+        }
+
+        int error = errno;
+        if (ctrls.error_idx < ctrls.count)
+        {
+            // The driver pointed at the failing control, retry the others without it
+            group[ctrls.error_idx]->error_code = error;
+            group.erase(group.begin() + ctrls.error_idx);
+        }
+        else if (group.size() == 1)
+        {
+            group[0]->error_code = error;
+            return;
+        }
         else
         {
-            throw CameraException("queryProperty: vidioc_queryctrl error: Property is not supported.", errno);
+            // The validation failed before any control was accessed and the driver does not tell which control was
+            // wrong, so access them one by one
+            for (ControlValue *control : group)
+            {
+                runExtCtrls(request, which, {control});
+            }
+            return;
+        }
+    }
+}
+
+void CameraCapture::invalidateControlCache()
+{
+    std::lock_guard<std::recursive_mutex> lock(control_mutex);
+    if (control_events)
+    {
+        v4l2_event_subscription subscription = {0};
+        subscription.type = V4L2_EVENT_ALL;
+        xioctl(VIDIOC_UNSUBSCRIBE_EVENT, &subscription);
+        control_events = false;
+    }
+    control_cache.clear();
+    control_ids.clear();
+    control_values.clear();
+    menu_cache.clear();
+    controls_enumerated = false;
+}
+
+int CameraCapture::processControlEvents() const
+{
+    std::lock_guard<std::recursive_mutex> lock(control_mutex);
+    if (!control_events)
+    {
+        return 0;
+    }
+
+    // Pending events are signalled with POLLPRI, checking it does not reach the device
+    pollfd camera_fd = {.fd = fd, .events = POLLPRI};
+    if (poll(&camera_fd, 1, 0) <= 0 || !(camera_fd.revents & POLLPRI))
+    {
+        return 0;
+    }
+
+    int changed = 0;
+    v4l2_event event;
+    do
+    {
+        memset(&event, 0, sizeof(event));
+        if (xioctl(VIDIOC_DQEVENT, &event) < 0)
+        {
+            if (errno == ENOENT)
+            {
+                break;
+            }
+            throw CameraException("Could not dequeue the control event", errno);
+        }
+
+        auto cached = control_cache.find(event.id);
+        if (event.type != V4L2_EVENT_CTRL || cached == control_cache.end())
+        {
+            continue;
         }
+        v4l2_query_ext_ctrl &query = cached->second;
+        if (event.u.ctrl.changes & V4L2_EVENT_CTRL_CH_FLAGS)
+        {
+            query.flags = event.u.ctrl.flags;
+        }
+        if (event.u.ctrl.changes & V4L2_EVENT_CTRL_CH_RANGE)
+        {
+            query.minimum = event.u.ctrl.minimum;
+            query.maximum = event.u.ctrl.maximum;
+            query.step = event.u.ctrl.step;
+            query.default_value = event.u.ctrl.default_value;
+            menu_cache.erase(event.id);
+        }
+        if (event.u.ctrl.changes & V4L2_EVENT_CTRL_CH_VALUE)
+        {
+            updateMirroredValue(event.id, query.type == V4L2_CTRL_TYPE_INTEGER64 ? event.u.ctrl.value64
+                                                                                 : event.u.ctrl.value);
+            changed++;
+        }
+    } while (event.pending > 0);
+    return changed;
+}
+
+bool CameraCapture::readMirroredValue(int property, int64_t &value) const
+{
+    std::lock_guard<std::recursive_mutex> lock(control_mutex);
+    enumerateControls();
+    processControlEvents();
+
+    auto mirrored = control_values.find(property);
+    if (mirrored == control_values.end())
+    {
+        return false;
+    }
+    value = mirrored->second;
+    return true;
+}
+
+void CameraCapture::updateMirroredValue(int property, int64_t value) const
+{
+    std::lock_guard<std::recursive_mutex> lock(control_mutex);
+    auto cached = control_cache.find(property);
+    if (!control_events || cached == control_cache.end())
+    {
+        return;
     }
-    else if (query.flags & V4L2_CTRL_FLAG_DISABLED)
+
+    // Volatile values change without events, and write-only and compound ones have no value to mirror
+    uint32_t unmirrored = V4L2_CTRL_FLAG_VOLATILE | V4L2_CTRL_FLAG_WRITE_ONLY | V4L2_CTRL_FLAG_HAS_PAYLOAD;
+    if (cached->second.flags & unmirrored)
     {
-        throw CameraException("queryProperty: vidioc_queryctrl error: Property is disabled.", errno);
+        control_values.erase(property);
+        return;
     }
+    control_values[property] = value;
 }
 
-void CameraCapture::getCtrls(int property, bool current, v4l2_ext_controls &ctrls) const
+void CameraCapture::getCtrls(int property, bool current, v4l2_ext_control &ctrl) const
 {
-    v4l2_queryctrl queryctrl;
+    v4l2_query_ext_ctrl queryctrl;
 
     queryProperty(property, queryctrl); // can throw exception
-    v4l2_ext_control ctrl[1];
     memset(&ctrl, 0, sizeof(ctrl));
-    ctrl[0].id = property;
-    ctrl[0].size = 0;
+    ctrl.id = property;
+    ctrl.size = 0;
 
+    v4l2_ext_controls ctrls;
     memset(&ctrls, 0, sizeof(ctrls));
     ctrls.which = current ? V4L2_CTRL_WHICH_CUR_VAL : V4L2_CTRL_WHICH_DEF_VAL;
     ctrls.count = 1;
-    ctrls.controls = ctrl;
+    ctrls.controls = &ctrl;
 
     try
     {
@@ -201,7 +952,7 @@ void CameraCapture::getCtrls(int property, bool current, v4l2_ext_controls &ctrl
                                   e.error_code);
             break;
         case ENOSPC:
-            throw CameraException("Too small size was set. Changed to " + std::to_string(ctrl[0].size), e.error_code);
+            throw CameraException("Too small size was set. Changed to " + std::to_string(ctrl.size), e.error_code);
             break;
         default:
             throw CameraException("", e.error_code);
@@ -211,13 +962,14 @@ void CameraCapture::getCtrls(int property, bool current, v4l2_ext_controls &ctrl
 
 void CameraCapture::setCtrl(int property, v4l2_ext_control *ctrl, bool warning)
 {
+    std::lock_guard<std::recursive_mutex> lock(control_mutex);
     int res;
     int value = ctrl[0].value;
 
     ctrl[0].id = property;
     ctrl[0].size = 0;
 
-    v4l2_queryctrl queryctrl;
+    v4l2_query_ext_ctrl queryctrl;
     queryProperty(property, queryctrl); // can throw exception
 
     v4l2_ext_controls ctrls;
@@ -251,6 +1003,8 @@ void CameraCapture::setCtrl(int property, v4l2_ext_control *ctrl, bool warning)
         }
     }
 
+    updateMirroredValue(property, ctrl[0].value);
+
     if (warning && value != ctrl[0].value)
     {
         std::cerr << "\n[WARNING] Parameter's value was clamped to " << ctrl[0].value
@@ -263,6 +1017,15 @@ void CameraCapture::requestBuffers(int n, std::vector<void *> locations)
 {
     if (locations.size() == 0)
     {
+        if (memory_type == V4L2_MEMORY_USERPTR && n > 0)
+        {
+            throw CameraException("Locations are required for the V4L2_MEMORY_USERPTR buffers");
+        }
+        if (memory_type == V4L2_MEMORY_DMABUF && (size_t)n > imported_dmabufs.size())
+        {
+            throw CameraException("Not enough DMABUFs imported. " + std::to_string(n) + " buffers requested, " +
+                                  std::to_string(imported_dmabufs.size()) + " imported");
+        }
         for (int i = 0; i < n; i++)
         {
             locations.push_back(NULL);
@@ -275,17 +1038,54 @@ void CameraCapture::requestBuffers(int n, std::vector<void *> locations)
 
     buffers.clear();
 
+    // REQBUFS sizes the buffers for the current format, so the ones fitting all format profiles are created separately
+    bool create_buffers = memory_type == V4L2_MEMORY_MMAP && n > 0 && min_buffer_size > buffer_size;
+
     // Request FrameBufferInfo from the device, which will be used for capturing frames
     struct v4l2_requestbuffers request_buffer = {0};
-    request_buffer.count = n;
+    request_buffer.count = create_buffers ? 0 : n;
     request_buffer.type = buffer_type;
-    request_buffer.memory = V4L2_MEMORY_MMAP;
+    request_buffer.memory = memory_type;
 
-    if (xioctl(fd, VIDIOC_REQBUFS, &request_buffer) < 0)
+    if (xioctl(VIDIOC_REQBUFS, &request_buffer) < 0)
     {
         throw CameraException("Requesting buffer failed. See errno and VIDEOC_REQBUFS docs for more information.");
     }
 
+    if (memory_type == V4L2_MEMORY_USERPTR)
+    {
+        // The memory is provided by the caller, so only the requested number of buffers can be used
+        for (int i = 0; i < n; i++)
+        {
+            buffers.push_back(std::make_shared<MMapBuffer>(locations[i], buffer_size));
+        }
+        return;
+    }
+
+    if (memory_type == V4L2_MEMORY_DMABUF)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            // DMABUF reports its size when seeking to its end
+            off_t size = lseek(imported_dmabufs[i], 0, SEEK_END);
+            if (size < buffer_size)
+            {
+                throw CameraException("DMABUF " + std::to_string(i) + " is too small. It should hold " +
+                                      std::to_string(buffer_size) + " bytes");
+            }
+
+            // Map it for the CPU access and keep a duplicate, so the buffer does not depend on the caller's descriptor
+            buffers.push_back(std::make_shared<MMapBuffer>(nullptr, size, imported_dmabufs[i], 0, buffer_options));
+            buffers.back()->dmabuf_fd = fcntl(imported_dmabufs[i], F_DUPFD_CLOEXEC, 0);
+        }
+        return;
+    }
+
+    if (create_buffers)
+    {
+        request_buffer.count = createBuffers(n, min_buffer_size);
+    }
+
     // ask for the requested buffers
 
     struct v4l2_buffer query_buffer;
@@ -299,7 +1099,7 @@ void CameraCapture::requestBuffers(int n, std::vector<void *> locations)
         query_buffer.memory = V4L2_MEMORY_MMAP;
         query_buffer.index = i;
 
-        if (xioctl(fd, VIDIOC_QUERYBUF, &query_buffer) < 0)
+        if (xioctl(VIDIOC_QUERYBUF, &query_buffer) < 0)
         {
             throw CameraException("Device did not return the queryBuffer information. See errno and VIDEOC_QUERYBUF "
                                   "docs for more information.");
@@ -307,132 +1107,297 @@ void CameraCapture::requestBuffers(int n, std::vector<void *> locations)
 
         // use a pointer to point to the newly created queryBuffer
         // map the memory address of the device to an address in memory
-        buffers.push_back(std::make_shared<MMapBuffer>(locations[i], query_buffer.length, fd, query_buffer.m.offset));
+        // The driver may allocate more buffers than requested
+        void *location = (size_t)i < locations.size() ? locations[i] : NULL;
+        buffers.push_back(std::make_shared<MMapBuffer>(location, query_buffer.length, fd, query_buffer.m.offset,
+                                                       buffer_options, backend == Backend::LIBV4L2));
+    }
+}
+
+int CameraCapture::createBuffers(int n, unsigned int size)
+{
+    v4l2_create_buffers create_buffers = {0};
+    create_buffers.count = n;
+    create_buffers.memory = memory_type;
+    create_buffers.format.type = buffer_type;
+
+    if (xioctl(VIDIOC_G_FMT, &create_buffers.format) < 0)
+    {
+        throw CameraException("Getting format failed. See errno and VIDEOC_G_FMT docs for more information", errno);
+    }
+    create_buffers.format.fmt.pix.sizeimage = size;
+
+    if (xioctl(VIDIOC_CREATE_BUFS, &create_buffers) == 0)
+    {
+        return create_buffers.count;
+    }
+    if (errno != ENOTTY && errno != EINVAL)
+    {
+        throw CameraException("Creating buffers failed. See errno and VIDEOC_CREATE_BUFS docs for more information.",
+                              errno);
+    }
+
+    // The driver cannot create larger buffers, so switching to a larger format will reallocate them
+    std::cerr << "[WARNING] VIDIOC_CREATE_BUFS is not supported, the buffers fit only the current format\n";
+
+    struct v4l2_requestbuffers request_buffer = {0};
+    request_buffer.count = n;
+    request_buffer.type = buffer_type;
+    request_buffer.memory = memory_type;
+
+    if (xioctl(VIDIOC_REQBUFS, &request_buffer) < 0)
+    {
+        throw CameraException("Requesting buffer failed. See errno and VIDEOC_REQBUFS docs for more information.");
+    }
+    return request_buffer.count;
+}
+
+void CameraCapture::setMemoryType(unsigned int memory)
+{
+    if (memory != V4L2_MEMORY_MMAP && memory != V4L2_MEMORY_USERPTR && memory != V4L2_MEMORY_DMABUF)
+    {
+        throw CameraException("Unsupported memory type " + std::to_string(memory));
+    }
+
+    stopStreaming();
+    memory_type = memory;
+    if (memory != V4L2_MEMORY_DMABUF)
+    {
+        closeImportedDmabufs();
     }
 }
 
+void CameraCapture::setBufferOptions(BufferOptions options)
+{
+    stopStreaming();
+    buffer_options = options;
+}
+
+void CameraCapture::importDmabufs(std::vector<int> dmabuf_fds)
+{
+    std::vector<int> copies;
+    for (int dmabuf_fd : dmabuf_fds)
+    {
+        int copy = fcntl(dmabuf_fd, F_DUPFD_CLOEXEC, 0);
+        if (copy < 0)
+        {
+            int error_code = errno;
+            for (int fd : copies)
+            {
+                close(fd);
+            }
+            throw CameraException("Could not duplicate the DMABUF descriptor " + std::to_string(dmabuf_fd), error_code);
+        }
+        copies.push_back(copy);
+    }
+
+    setMemoryType(V4L2_MEMORY_DMABUF);
+    closeImportedDmabufs();
+    imported_dmabufs = copies;
+}
+
+void CameraCapture::closeImportedDmabufs()
+{
+    for (int fd : imported_dmabufs)
+    {
+        close(fd);
+    }
+    imported_dmabufs.clear();
+}
+
+int CameraCapture::exportBuffer(MMapBuffer &buffer, int buffer_no) const
+{
+    std::lock_guard<std::mutex> lock(export_mutex);
+    // Imported DMABUFs already have a descriptor and USERPTR memory cannot be exported
+    if (buffer.dmabuf_fd >= 0 || memory_type != V4L2_MEMORY_MMAP || !can_export)
+    {
+        return buffer.dmabuf_fd;
+    }
+
+    v4l2_exportbuffer export_buffer = {0};
+    export_buffer.type = buffer_type;
+    export_buffer.index = buffer_no;
+    export_buffer.flags = O_RDWR | O_CLOEXEC;
+
+    if (xioctl(VIDIOC_EXPBUF, &export_buffer) < 0)
+    {
+        // Not all drivers can export buffers, the frames are still available through the mapping
+        can_export = false;
+        return -1;
+    }
+    buffer.dmabuf_fd = export_buffer.fd;
+    return buffer.dmabuf_fd;
+}
+
+int CameraCapture::getDmabufFd(int buffer_no) const
+{
+    if (buffer_no < 0 || (size_t)buffer_no >= buffers.size())
+    {
+        throw CameraException("Buffer " + std::to_string(buffer_no) + " is not allocated.");
+    }
+    return exportBuffer(*buffers[buffer_no], buffer_no);
+}
+
 std::pair<int, int> CameraCapture::getFormat() const { return std::pair<int, int>(width, height); }
 
-void CameraCapture::enumerateMenu(v4l2_queryctrl &queryctrl) const
+void CameraCapture::enumerateMenu(const v4l2_query_ext_ctrl &queryctrl) const
 {
-    struct v4l2_querymenu querymenu;
     printf("        Available items:\n");
 
+    for (const v4l2_querymenu &querymenu : queryMenu(queryctrl))
+    {
+        std::cout << "        " << querymenu.index << ". " << querymenu.name << std::endl;
+    }
+}
+
+const std::vector<v4l2_querymenu> &CameraCapture::queryMenu(const v4l2_query_ext_ctrl &queryctrl) const
+{
+    auto cached = menu_cache.find(queryctrl.id);
+    if (cached != menu_cache.end())
+    {
+        return cached->second;
+    }
+
+    std::vector<v4l2_querymenu> &items = menu_cache[queryctrl.id];
+    v4l2_querymenu querymenu;
     memset(&querymenu, 0, sizeof(querymenu));
     querymenu.id = queryctrl.id;
 
     for (querymenu.index = queryctrl.minimum; querymenu.index <= queryctrl.maximum; querymenu.index++)
     {
-        if (0 == xioctl(fd, VIDIOC_QUERYMENU, &querymenu))
+        if (0 == xioctl(VIDIOC_QUERYMENU, &querymenu))
         {
-            std::cout << "        " << querymenu.index << ". " << querymenu.name << std::endl;
+            items.push_back(querymenu);
         }
     }
+    return items;
 }
 
-int CameraCapture::printControl(v4l2_queryctrl &queryctrl) const
+void CameraCapture::printControl(const v4l2_query_ext_ctrl &queryctrl, const ControlValue &value) const
 {
-    if (0 == xioctl(fd, VIDIOC_QUERYCTRL, &queryctrl))
+    if (value.error_code == 0)
     {
-        try
-        {
-            int value;
-            get(queryctrl.id, value);
-            std::cout << queryctrl.id << " " << queryctrl.name << ": " << value << " (default: ";
-            get(queryctrl.id, value, false);
-            std::cout << value << ")" << std::endl;
-        }
-        catch (CameraException e)
-        {
-            std::cout << "\e[31m" << e.what() << "\e[0m" << std::endl;
-        }
-
-        if (queryctrl.type == V4L2_CTRL_TYPE_MENU)
-        {
-            enumerateMenu(queryctrl);
-        }
+        std::cout << queryctrl.id << " " << queryctrl.name << ": " << value.value
+                  << " (default: " << queryctrl.default_value << ")" << std::endl;
     }
     else
     {
-        if (errno == EINVAL)
-        {
-            return 1;
-        }
+        std::cout << "\e[31m" << queryctrl.name << ": " << strerror(value.error_code) << "\e[0m" << std::endl;
+    }
+
+    if (queryctrl.type == V4L2_CTRL_TYPE_MENU)
+    {
+        enumerateMenu(queryctrl);
     }
-    return 0;
 }
 
 void CameraCapture::printControls() const
 {
-    int value;
+    std::lock_guard<std::recursive_mutex> lock(control_mutex);
     std::cout << "\nCONTROLS\n"
               << "------------------\n";
 
-    struct v4l2_queryctrl queryctrl;
-    memset(&queryctrl, 0, sizeof(queryctrl));
-
-    for (queryctrl.id = V4L2_CID_BASE; queryctrl.id < V4L2_CID_LASTP1; queryctrl.id++)
-    {
-        printControl(queryctrl);
-    }
+    enumerateControls();
 
-    // private base
-    for (queryctrl.id = V4L2_CID_PRIVATE_BASE;; queryctrl.id++)
+    // Read all values at once, skipping the controls holding arrays or structures
+    std::vector<ControlValue> values;
+    for (uint32_t id : control_ids)
     {
-        if (printControl(queryctrl) == 1)
+        const v4l2_query_ext_ctrl &queryctrl = control_cache.at(id);
+        if (!(queryctrl.flags & (V4L2_CTRL_FLAG_HAS_PAYLOAD | V4L2_CTRL_FLAG_DISABLED)))
         {
-            break;
+            values.push_back({.id = id, .value = 0});
         }
     }
-    for (queryctrl.id = V4L2_CID_CAMERA_CLASS_BASE; queryctrl.id < CAMERA_CLASS_CONTROLS_END; queryctrl.id++)
+    getMany(values);
+
+    for (const ControlValue &value : values)
     {
-        printControl(queryctrl);
+        printControl(control_cache.at(value.id), value);
     }
 
     std::cout << std::endl;
 }
 
-void CameraCapture::grab(int buffer_no, int number_of_buffers, std::vector<void *> locations)
+FrameInfo CameraCapture::grab(int buffer_no, int number_of_buffers, std::vector<void *> locations)
 {
-    if (ready_to_capture && buffers.size() != number_of_buffers)
+    if (continuous_streaming)
+    {
+        throw CameraException("grab: the camera is in the continuous streaming mode. Use dequeueBuffer instead.");
+    }
+
+    // The driver may have allocated more buffers than requested, they are reused
+    if (ready_to_capture && buffers.size() < (size_t)number_of_buffers)
     {
         stopStreaming();
     }
 
     if (!ready_to_capture)
     {
-        requestBuffers(number_of_buffers, locations); // buffers in the device memory
-
-        info_buffer = std::make_shared<v4l2_buffer>();
-        memset(info_buffer.get(), 0, sizeof(info_buffer));
-        info_buffer->type = buffer_type;
-        info_buffer->memory = V4L2_MEMORY_MMAP;
-
-        // Activate streaming
-        if (xioctl(fd, VIDIOC_STREAMON, &buffer_type) < 0)
+        if (!canReuseBuffers(number_of_buffers, locations))
         {
-            throw CameraException(
-                "Could not start streaming. See errno and VIDEOC_STREAMON docs for more information.");
+            requestBuffers(number_of_buffers, locations); // buffers in the device memory
         }
+        streamOn();
+    }
+
+    // Only this buffer is queued, so it is the one which gets dequeued
+    queueBuffer(buffer_no);
+    return buffers[dequeueBuffer()]->info;
+}
+
+FrameInfo CameraCapture::getFrameInfo(int buffer_no) const
+{
+    checkBuffer(buffer_no);
+    return buffers[buffer_no]->info;
+}
+
+void CameraCapture::start(FrameCallback callback, BackpressurePolicy policy, size_t queue_size, int number_of_buffers)
+{
+    stop();
+    dispatcher = std::make_unique<FrameDispatcher>(*this, callback, policy, queue_size, number_of_buffers);
+    dispatcher->start();
+}
 
-        ready_to_capture = true;
+void CameraCapture::stop()
+{
+    if (dispatcher)
+    {
+        dispatcher->stop();
+        dispatcher.reset();
     }
+}
 
-    info_buffer->index = buffer_no;
+FrameLease CameraCapture::acquireFrame()
+{
+    if (!continuous_streaming)
+    {
+        throw CameraException("acquireFrame: the continuous streaming is not active. Call startStreaming first.");
+    }
+    return FrameLease(this, dequeueBuffer());
+}
 
-    // Queue the buffer
-    if (xioctl(fd, VIDIOC_QBUF, info_buffer.get()) < 0)
+FrameLease CameraCapture::grabLatest()
+{
+    if (!continuous_streaming)
     {
-        throw CameraException("Could not queue the buffer. See errno and VIDEOC_QBUF docs for more information.");
+        throw CameraException("grabLatest: the continuous streaming is not active. Call startStreaming first.");
     }
 
-    // Dequeue the buffer
-    if (xioctl(fd, VIDIOC_DQBUF, info_buffer.get()) < 0)
+    FrameLease latest(this, dequeueBuffer());
+
+    // Poll before dequeuing, so the blocking mode does not wait for a frame that is not captured yet
+    while (waitForFrame(std::chrono::milliseconds(0)))
     {
-        throw CameraException("Could not dequeue the buffer. See errno and VIDEOC_DQBUF docs for more information.");
+        int buffer_no = tryDequeueBuffer();
+        if (buffer_no < 0)
+        {
+            break;
+        }
+        // The previous frame is stale, the assignment returns its buffer to the driver
+        latest = FrameLease(this, buffer_no);
     }
-    // Frames get written after dequeuing the buffer
-    buffers[buffer_no].get()->bytesused = info_buffer->bytesused;
+    return latest;
 }
 
 void CameraCapture::checkBuffer(int buffer_no) const
@@ -511,6 +1476,99 @@ cv::Mat CameraCapture::capture(int raw_frame_dtype, int buffer_no, int number_of
     return *frame;
 }
 
+std::vector<cv::Mat> CameraCapture::captureBurst(int n, int raw_frame_dtype, int number_of_buffers)
+{
+    // set raw_frame_dtype from converter
+    if (hasConverter())
+    {
+        if (raw_frame_dtype != -1 && raw_frame_dtype != converter->input_format)
+        {
+            throw CameraException(
+                "captureBurst: raw_frame_dtype shouldn't be provided for the cameracapture with a converter");
+        }
+        raw_frame_dtype = converter->input_format;
+    }
+
+    bool started_here = !continuous_streaming;
+    if (started_here)
+    {
+        startStreaming(number_of_buffers);
+    }
+
+    std::vector<cv::Mat> frames(n);
+    try
+    {
+        int restarts = 0;
+        unsigned int previous_sequence = 0;
+        for (int i = 0; i < n; i++)
+        {
+            FrameLease frame = acquireFrame();
+            if (i > 0 && frame.info().sequence != previous_sequence + 1)
+            {
+                if (++restarts > BURST_MAX_RESTARTS)
+                {
+                    throw CameraException(
+                        "captureBurst: the driver keeps dropping frames. Try more buffers or fewer frames.");
+                }
+                // The frames are no longer consecutive, start over from the current one
+                i = 0;
+            }
+            previous_sequence = frame.info().sequence;
+
+            // Copy the frame to let the driver reuse the buffer right away
+            std::shared_ptr<cv::Mat> raw_frame;
+            read(raw_frame, raw_frame_dtype, frame.index());
+            if (frames[i].empty())
+            {
+                // Allocate all outputs at once, so the copying keeps up with the sensor
+                for (cv::Mat &output : frames)
+                {
+                    output.create(raw_frame->size(), raw_frame->type());
+                }
+            }
+            raw_frame->copyTo(frames[i]);
+        }
+    }
+    catch (...)
+    {
+        // Do not leave the stream started here running with all buffers queued
+        if (started_here)
+        {
+            try
+            {
+                stopStreaming();
+            }
+            catch (CameraException e)
+            {
+                std::cerr << "[WARNING] Could not stop the stream (Error " << e.what() << ")\n";
+            }
+        }
+        throw;
+    }
+
+    if (started_here)
+    {
+        stopStreaming();
+    }
+
+    if (hasConverter())
+    {
+        cv::parallel_for_(cv::Range(0, n),
+                          [this, &frames](const cv::Range &range)
+                          {
+                              for (int i = range.start; i < range.end; i++)
+                              {
+                                  frames[i] = converter->convert(frames[i]);
+                              }
+                          });
+    }
+    else
+    {
+        std::cerr << "WARNING: No converter provided - omitting preprocessing\n";
+    }
+    return frames;
+}
+
 std::string CameraCapture::getConfigFilename()
 {
     // get the driver name
@@ -553,30 +1611,43 @@ void CameraCapture::saveTriggerInfo(TriggerInfo trigger_info, rapidjson::PrettyW
 
 std::string CameraCapture::saveConfig(std::string filename)
 {
+    std::lock_guard<std::recursive_mutex> lock(control_mutex);
     rapidjson::StringBuffer s;
     rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(s);
 
-    struct v4l2_queryctrl queryctrl;
-    memset(&queryctrl, 0, sizeof(queryctrl));
-
-    // Get values for all controls
+    enumerateControls();
 
-    writer.StartArray();
-    for (queryctrl.id = V4L2_CID_BASE; queryctrl.id < V4L2_CID_LASTP1; queryctrl.id++)
+    // Get values for all controls that can be restored
+    std::vector<ControlValue> values;
+    for (uint32_t id : control_ids)
     {
-        saveControlValue(queryctrl, writer);
+        const v4l2_query_ext_ctrl &queryctrl = control_cache.at(id);
+        bool scalar = queryctrl.type == V4L2_CTRL_TYPE_INTEGER || queryctrl.type == V4L2_CTRL_TYPE_BOOLEAN ||
+                      queryctrl.type == V4L2_CTRL_TYPE_MENU || queryctrl.type == V4L2_CTRL_TYPE_INTEGER_MENU;
+        uint32_t skipped = V4L2_CTRL_FLAG_DISABLED | V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_WRITE_ONLY;
+        if (scalar && !(queryctrl.flags & skipped))
+        {
+            values.push_back({.id = id, .value = 0});
+        }
     }
+    getMany(values);
 
-    for (queryctrl.id = V4L2_CID_PRIVATE_BASE;; queryctrl.id++)
+    writer.StartArray();
+    for (const ControlValue &value : values)
     {
-        if (saveControlValue(queryctrl, writer) == 1)
+        switch (value.error_code)
         {
+        case 0:
+            saveControlValue(control_cache.at(value.id), value.value, writer);
             break;
-        };
-    }
-    for (queryctrl.id = V4L2_CID_CAMERA_CLASS_BASE; queryctrl.id < CAMERA_CLASS_CONTROLS_END; queryctrl.id++)
-    {
-        saveControlValue(queryctrl, writer);
+        // Skip invalid arguments (nonexistent properties)
+        case EINVAL:
+            break;
+        default:
+            throw CameraException("Error occurred while collecting data for the writer, please check your camera "
+                                  "settings and try again",
+                                  value.error_code);
+        }
     }
 
     if (this->trigger_info.has_value())
@@ -605,6 +1676,7 @@ std::string CameraCapture::saveConfig(std::string filename)
 
 std::string CameraCapture::loadConfig(std::string filename)
 {
+    std::lock_guard<std::recursive_mutex> lock(control_mutex);
     // Read the file
     if (filename == "")
     {
@@ -628,7 +1700,8 @@ std::string CameraCapture::loadConfig(std::string filename)
     }
 
     auto properties = doc.GetArray();
-    int id, value;
+    std::vector<ControlValue> controls;
+    std::vector<std::string> names;
 
     for (auto itr = properties.Begin(); itr != properties.End(); itr++)
     {
@@ -650,207 +1723,424 @@ std::string CameraCapture::loadConfig(std::string filename)
                 info.activation_mode = property.FindMember("activation_value")->value.GetInt();
                 this->trigger_info.emplace(info);
             }
-            return filename;
+            break;
         }
-        // Apply the values
-        id = itr->FindMember("id")->value.GetInt();
-        value = itr->FindMember("value")->value.GetInt();
+        controls.push_back({.id = (uint32_t)itr->FindMember("id")->value.GetInt(),
+                            .value = itr->FindMember("value")->value.GetInt()});
+        names.push_back(itr->FindMember("name")->value.GetString());
+    }
 
-        try
+    // Write only the values that differ from the current ones
+    std::vector<ControlValue> current = controls;
+    getMany(current);
+    std::vector<ControlValue> changed;
+    std::vector<std::string> changed_names;
+    for (size_t i = 0; i < controls.size(); i++)
+    {
+        if (current[i].error_code != 0 || current[i].value != controls[i].value)
         {
-            set(id, value);
+            changed.push_back(controls[i]);
+            changed_names.push_back(names[i]);
         }
-        catch (CameraException e)
+    }
+
+    // Switch the automatic modes first, as they decide whether the manual values can be set
+    std::vector<size_t> order(changed.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        order[i] = i;
+    }
+    auto manual = std::stable_partition(order.begin(), order.end(),
+                                        [&changed](size_t i) { return isAutoControl(changed[i].id); });
+    std::vector<ControlValue> ordered;
+    for (size_t i : order)
+    {
+        ordered.push_back(changed[i]);
+    }
+
+    // Apply the values. setMany groups the controls by class, so the automatic ones go in a separate call.
+    std::span<ControlValue> all(ordered);
+    size_t automatic = manual - order.begin();
+    setMany(all.first(automatic));
+    setMany(all.subspan(automatic));
+    for (size_t i = 0; i < ordered.size(); i++)
+    {
+        if (ordered[i].error_code != 0)
         {
-            std::cerr << "[WARNING] Cannot set " << itr->FindMember("name")->value.GetString() << " (Error " << e.what()
-                      << ")\n";
+            std::cerr << "[WARNING] Cannot set " << changed_names[order[i]] << " (Error "
+                      << strerror(ordered[i].error_code) << ")\n";
         }
     }
 
     return filename;
 }
 
-int CameraCapture::saveControlValue(v4l2_queryctrl &queryctrl, rapidjson::PrettyWriter<rapidjson::StringBuffer> &writer)
+void CameraCapture::saveControlValue(const v4l2_query_ext_ctrl &queryctrl, int64_t value,
+                                     rapidjson::PrettyWriter<rapidjson::StringBuffer> &writer) const
 {
-    int value;
-    if (xioctl(fd, VIDIOC_QUERYCTRL, &queryctrl) == 0)
-    {
-        if (queryctrl.flags & V4L2_CTRL_FLAG_DISABLED)
-        {
-            return 0;
-        }
+    writer.StartObject();
+    writer.Key("id");
+    writer.Int(queryctrl.id);
+    writer.Key("name");
+    writer.String(reinterpret_cast<char const *>(queryctrl.name));
+    writer.Key("type");
+    writer.Int(queryctrl.type);
+    writer.Key("value");
+    writer.Int(value);
+    writer.EndObject();
+}
 
-        try
-        {
-            get(queryctrl.id, value);
-            writer.StartObject();
-            writer.Key("id");
-            writer.Int(queryctrl.id);
-            writer.Key("name");
-            writer.String(reinterpret_cast<char const *>(queryctrl.name));
-            writer.Key("type");
-            writer.Int(queryctrl.type);
-            writer.Key("value");
-            writer.Int(value);
-            writer.EndObject();
-        }
-        catch (CameraException e)
-        {
-            switch (e.error_code)
-            {
-            // Skip invalid arguments (nonexistent properties);
-            // they were uncaught and unchecked at that point
-            case EINVAL:
-                break;
-            default:
-                throw CameraException("Error occurred while collecting data for the writer, please check your camera "
-                                      "settings and try again",
-                                      e.error_code);
-            }
-        }
+CameraCapture::CameraPropertyStatus CameraCapture::queryProperty(int32_t propertyID, CameraProperty &property) const
+{
+    std::lock_guard<std::recursive_mutex> lock(control_mutex);
+    v4l2_query_ext_ctrl queryctrl;
+    if (!findControl(propertyID, queryctrl))
+    {
+        return CameraPropertyStatus::UNSUPPORTED;
     }
-    else
+    if (queryctrl.flags & V4L2_CTRL_FLAG_DISABLED)
     {
-        if (errno == EINVAL)
-        {
-            return 1;
-        }
+        return CameraPropertyStatus::DISABLED;
     }
-    return 0;
+
+    property.id = propertyID;
+    property.name = (char *)queryctrl.name;
+    property.type = queryctrl.type;
+    property.defaultValue = queryctrl.default_value;
+    property.step = queryctrl.step;
+    property.maximum = queryctrl.maximum;
+    property.minimum = queryctrl.minimum;
+
+    return CameraPropertyStatus::ENABLED;
 }
 
-CameraCapture::CameraPropertyStatus CameraCapture::queryProperty(int32_t propertyID, CameraProperty &property) const
+std::vector<CameraCapture::CameraProperty> CameraCapture::queryProperties() const
 {
-    v4l2_queryctrl queryctrl;
-    memset(&queryctrl, 0, sizeof(queryctrl));
-    queryctrl.id = propertyID;
+    std::lock_guard<std::recursive_mutex> lock(control_mutex);
+    std::vector<CameraProperty> result;
+    CameraProperty property;
 
-    if (!xioctl(fd, VIDIOC_QUERYCTRL, &queryctrl))
+    enumerateControls();
+    for (uint32_t property_id : control_ids)
     {
-        if (queryctrl.flags & V4L2_CTRL_FLAG_DISABLED)
+        // Skip the controls holding arrays or structures
+        if (control_cache.at(property_id).flags & V4L2_CTRL_FLAG_HAS_PAYLOAD)
+        {
+            continue;
+        }
+        if (queryProperty(property_id, property) != CameraPropertyStatus::ENABLED)
         {
-            return CameraPropertyStatus::DISABLED;
+            continue;
         }
-        get(queryctrl.id, property.defaultValue, false);
-        property.id = propertyID;
-        property.name = (char *)queryctrl.name;
-        property.type = queryctrl.type;
-        property.step = queryctrl.step;
-        property.maximum = queryctrl.maximum;
-        property.minimum = queryctrl.minimum;
 
-        return CameraPropertyStatus::ENABLED;
+        result.push_back(property);
     }
-    else if (errno == EINVAL)
+
+    return result;
+}
+
+std::vector<CameraCapture::CameraPropertyMenuEntry> CameraCapture::queryPropertyMenuEntries(int32_t propertyID) const
+{
+    std::lock_guard<std::recursive_mutex> lock(control_mutex);
+    std::vector<CameraCapture::CameraPropertyMenuEntry> result;
+
+    v4l2_query_ext_ctrl queryctrl;
+    if (!findControl(propertyID, queryctrl))
     {
-        return CameraPropertyStatus::UNSUPPORTED;
+        return result;
     }
-    else
+
+    for (const v4l2_querymenu &querymenu : queryMenu(queryctrl))
     {
-        throw CameraException("Unknown error");
+        result.push_back({querymenu.index, (char *)querymenu.name});
     }
+
+    return result;
 }
 
-std::vector<CameraCapture::CameraProperty> CameraCapture::queryProperties() const
+CameraCapture::CameraPropertyDetails CameraCapture::queryPropertyDetails(int32_t propertyID) const
 {
-    std::vector<CameraProperty> result;
+    std::lock_guard<std::recursive_mutex> lock(control_mutex);
     CameraProperty property;
-
-    std::vector<int32_t> properties;
-    for (int i = V4L2_CID_BASE; i < V4L2_CID_LASTP1; i++)
+    if (queryProperty(propertyID, property) != CameraPropertyStatus::ENABLED)
     {
-        properties.push_back(i);
+        throw CameraException("Queried against unsupported property");
     }
-    for (int i = V4L2_CID_CAMERA_CLASS_BASE; i < V4L2_CID_CAMERA_CLASS_BASE + 36; i++)
+
+    return CameraPropertyDetails{.property = property,
+                                 .menuEntries = property.type == V4L2_CTRL_TYPE_MENU
+                                                    ? queryPropertyMenuEntries(propertyID)
+                                                    : std::vector<CameraPropertyMenuEntry>()};
+}
+
+const std::vector<FormatDescription> &CameraCapture::getFormats() const
+{
+    enumerateFormats();
+    return formats;
+}
+
+void CameraCapture::enumerateFormats() const
+{
+    if (formats_enumerated)
     {
-        properties.push_back(i);
+        return;
     }
 
-    for (int32_t property_id : properties)
+    formats.clear();
+    FormatDescription description;
+    memset(&description.format, 0, sizeof(description.format));
+    description.format.type = buffer_type;
+    while (xioctl(VIDIOC_ENUM_FMT, &description.format) == 0)
     {
-        if (queryProperty(property_id, property) != CameraPropertyStatus::ENABLED)
+        v4l2_frmsizeenum size;
+        memset(&size, 0, sizeof(size));
+        size.pixel_format = description.format.pixelformat;
+        description.sizes.clear();
+        description.intervals.clear();
+        while (xioctl(VIDIOC_ENUM_FRAMESIZES, &size) == 0)
         {
-            continue;
-        }
+            description.sizes.push_back(size);
+
+            // The intervals are listed for a single size, for ranges take the largest one
+            v4l2_frmivalenum interval;
+            memset(&interval, 0, sizeof(interval));
+            interval.pixel_format = size.pixel_format;
+            interval.width = size.type == V4L2_FRMSIZE_TYPE_DISCRETE ? size.discrete.width : size.stepwise.max_width;
+            interval.height = size.type == V4L2_FRMSIZE_TYPE_DISCRETE ? size.discrete.height : size.stepwise.max_height;
+            description.intervals.emplace_back();
+            while (xioctl(VIDIOC_ENUM_FRAMEINTERVALS, &interval) == 0)
+            {
+                description.intervals.back().push_back(interval);
+                if (interval.type != V4L2_FRMIVAL_TYPE_DISCRETE)
+                {
+                    break;
+                }
+                interval.index++;
+            }
 
-        result.push_back(property);
+            // Stepwise and continuous ranges are described by a single entry
+            if (size.type != V4L2_FRMSIZE_TYPE_DISCRETE)
+            {
+                break;
+            }
+            size.index++;
+        }
+        formats.push_back(description);
+        description.format.index++;
     }
-    for (int property_id = V4L2_CID_PRIVATE_BASE;; property_id++)
+    if (errno != EINVAL)
     {
-        CameraPropertyStatus status = queryProperty(property_id, property);
+        throw CameraException("Could not enumerate the formats. See errno and VIDIOC_ENUM_FMT docs for more "
+                              "information.",
+                              errno);
+    }
+    formats_enumerated = true;
+}
 
-        if (status == CameraPropertyStatus::DISABLED)
+std::optional<CameraCapture::FormatChoice> CameraCapture::chooseFormat(unsigned int width, unsigned int height,
+                                                                       double fps) const
+{
+    std::optional<FormatChoice> best;
+    for (const FormatDescription &description : getFormats())
+    {
+        // Only the formats, which can be converted, give the requested output
+        auto info = formats_info.find(description.format.pixelformat);
+        if (info == formats_info.end())
         {
             continue;
         }
-
-        if (status == CameraPropertyStatus::UNSUPPORTED)
+        double cost_per_pixel = info->second()->cost();
+        if (description.format.flags & V4L2_FMT_FLAG_COMPRESSED)
         {
-            break;
+            cost_per_pixel *= COMPRESSED_FORMAT_PENALTY;
+        }
+        if (description.format.flags & V4L2_FMT_FLAG_EMULATED)
+        {
+            cost_per_pixel *= EMULATED_FORMAT_PENALTY;
         }
 
-        result.push_back(property);
-    }
+        for (size_t i = 0; i < description.sizes.size(); i++)
+        {
+            const v4l2_frmsizeenum &size = description.sizes[i];
+            FormatChoice candidate = {.pixelformat = description.format.pixelformat};
+            if (size.type == V4L2_FRMSIZE_TYPE_DISCRETE)
+            {
+                candidate.width = size.discrete.width;
+                candidate.height = size.discrete.height;
+            }
+            else
+            {
+                // Round the requested size up to the nearest one in the range
+                const v4l2_frmsize_stepwise &range = size.stepwise;
+                candidate.width = roundUpToStep(width, range.min_width, range.step_width);
+                candidate.height = roundUpToStep(height, range.min_height, range.step_height);
+                if (candidate.width > range.max_width || candidate.height > range.max_height)
+                {
+                    continue;
+                }
+            }
+            if (candidate.width < width || candidate.height < height)
+            {
+                continue;
+            }
 
-    return result;
+            // Without the intervals listed, assume the camera can keep up
+            candidate.fps = description.intervals[i].empty() ? fps : 0;
+            for (const v4l2_frmivalenum &interval : description.intervals[i])
+            {
+                // The fastest rate is the shortest interval: the discrete one, or the lower end of the range
+                const v4l2_fract &shortest =
+                    interval.type == V4L2_FRMIVAL_TYPE_DISCRETE ? interval.discrete : interval.stepwise.min;
+                if (shortest.numerator != 0)
+                {
+                    candidate.fps = std::max(candidate.fps, (double)shortest.denominator / shortest.numerator);
+                }
+            }
+            if (candidate.fps < fps)
+            {
+                continue;
+            }
+
+            candidate.cost = cost_per_pixel * candidate.width * candidate.height;
+            if (!best.has_value() || candidate.cost < best->cost)
+            {
+                best = candidate;
+            }
+        }
+    }
+    return best;
 }
 
-std::vector<CameraCapture::CameraPropertyMenuEntry> CameraCapture::queryPropertyMenuEntries(int32_t propertyID) const
+CameraCapture::FormatChoice CameraCapture::setBestFormat(unsigned int width, unsigned int height, double fps)
 {
-    std::vector<CameraCapture::CameraPropertyMenuEntry> result;
+    std::optional<FormatChoice> choice = chooseFormat(width, height, fps);
+    if (!choice.has_value())
+    {
+        throw CameraException("setBestFormat: none of the formats gives " + std::to_string(width) + " x " +
+                              std::to_string(height) + " at " + std::to_string(fps) + " fps");
+    }
+    setFormat(choice->width, choice->height, choice->pixelformat);
+    if (fps > 0)
+    {
+        try
+        {
+            choice->fps = setFrameRate(fps);
+        }
+        catch (CameraException e)
+        {
+            std::cerr << "[WARNING] Cannot set the frame rate (Error " << e.what() << ")\n";
+        }
+    }
+    return *choice;
+}
 
-    v4l2_queryctrl queryctrl;
-    memset(&queryctrl, 0, sizeof(queryctrl));
-    queryctrl.id = propertyID;
-    xioctl(fd, VIDIOC_QUERYCTRL, &queryctrl);
+bool CameraCapture::useProfileCache(std::string filename)
+{
+    std::lock_guard<std::recursive_mutex> lock(control_mutex);
+    v4l2_capability capability;
+    runIoctl(VIDIOC_QUERYCAP, &capability);
 
-    v4l2_querymenu querymenu;
-    memset(&querymenu, 0, sizeof(querymenu));
-    querymenu.id = queryctrl.id;
+    if (filename == "")
+    {
+        filename = getProfileFilename(capability);
+    }
 
-    for (querymenu.index = queryctrl.minimum; querymenu.index <= queryctrl.maximum; querymenu.index++)
+    std::optional<DeviceProfile> profile = DeviceProfile::load(filename, capability);
+    if (profile.has_value())
     {
-        if (not xioctl(fd, VIDIOC_QUERYMENU, &querymenu))
+        invalidateControlCache();
+        for (const v4l2_query_ext_ctrl &queryctrl : profile->controls)
+        {
+            control_ids.push_back(queryctrl.id);
+            control_cache[queryctrl.id] = queryctrl;
+            subscribeControlEvents(queryctrl.id);
+        }
+        controls_enumerated = true;
+        for (const v4l2_query_ext_ctrl &queryctrl : profile->controls)
+        {
+            if (queryctrl.type == V4L2_CTRL_TYPE_MENU || queryctrl.type == V4L2_CTRL_TYPE_INTEGER_MENU)
+            {
+                menu_cache[queryctrl.id];
+            }
+        }
+        for (const v4l2_querymenu &querymenu : profile->menus)
         {
-            result.push_back({querymenu.index, (char *)querymenu.name});
+            menu_cache[querymenu.id].push_back(querymenu);
         }
+        formats = profile->formats;
+        formats_enumerated = true;
+        return true;
     }
 
-    return result;
+    // Probe the camera and remember the results for the next time
+    DeviceProfile probed;
+    probed.capability = capability;
+    enumerateControls();
+    for (uint32_t id : control_ids)
+    {
+        const v4l2_query_ext_ctrl &queryctrl = control_cache.at(id);
+        probed.controls.push_back(queryctrl);
+        if (queryctrl.type == V4L2_CTRL_TYPE_MENU || queryctrl.type == V4L2_CTRL_TYPE_INTEGER_MENU)
+        {
+            const std::vector<v4l2_querymenu> &items = queryMenu(queryctrl);
+            probed.menus.insert(probed.menus.end(), items.begin(), items.end());
+        }
+    }
+    probed.formats = getFormats();
+    probed.save(filename);
+    return false;
 }
 
-CameraCapture::CameraPropertyDetails CameraCapture::queryPropertyDetails(int32_t propertyID) const
+std::string CameraCapture::getProfileFilename(const v4l2_capability &capability) const
 {
-    CameraProperty property;
-    if (queryProperty(propertyID, property) != CameraPropertyStatus::ENABLED)
+    std::string filename = ".grabthecam-" + std::string((char *)capability.driver) + "-" +
+                           std::string((char *)capability.bus_info);
+    // libv4l2 adds the emulated formats, so its format table differs from the raw one
+    if (backend == Backend::LIBV4L2)
     {
-        throw CameraException("Queried against unsupported property");
+        filename += "-libv4l2";
     }
+    // The bus info may contain path separators
+    std::replace_if(
+        filename.begin(), filename.end(), [](char c) { return c == '/' || c == ':' || c == ' '; }, '_');
+    return filename;
+}
 
-    return CameraPropertyDetails{.property = property,
-                                 .menuEntries = property.type == V4L2_CTRL_TYPE_MENU
-                                                    ? queryPropertyMenuEntries(propertyID)
-                                                    : std::vector<CameraPropertyMenuEntry>()};
+std::string CameraCapture::getBackendName() const
+{
+    return backend == Backend::LIBV4L2 ? "libv4l2" : "raw";
+}
+
+bool CameraCapture::isFormatEmulated() const
+{
+    for (const FormatDescription &description : getFormats())
+    {
+        if (description.format.pixelformat == (uint32_t)v4l2_format_code)
+        {
+            return description.format.flags & V4L2_FMT_FLAG_EMULATED;
+        }
+    }
+    return false;
 }
 
 void CameraCapture::defaultEnableTrigger() const
 {
     TriggerInfo trigger_info = this->trigger_info.value();
     struct v4l2_control enable_trigger = {.id = trigger_info.mode_reg, .value = 1};
-    if (ioctl(this->fd, VIDIOC_S_CTRL, &enable_trigger) == -1)
+    if (xioctl(VIDIOC_S_CTRL, &enable_trigger) == -1)
     {
         throw CameraException("Error while enabling trigger ");
     }
 
     struct v4l2_control set_trigger_source = {.id = trigger_info.source_reg, .value = trigger_info.source_value};
-    if (ioctl(this->fd, VIDIOC_S_CTRL, &set_trigger_source) == -1)
+    if (xioctl(VIDIOC_S_CTRL, &set_trigger_source) == -1)
     {
         throw CameraException("Error while setting trigger source");
     }
 
     struct v4l2_control set_trigger_activation = {.id = trigger_info.activation_reg,
                                                   .value = trigger_info.activation_mode};
-    if (ioctl(this->fd, VIDIOC_S_CTRL, &set_trigger_activation) == -1)
+    if (xioctl(VIDIOC_S_CTRL, &set_trigger_activation) == -1)
     {
         throw CameraException("Error while setting trigger activation mode");
     }
@@ -0,0 +1,71 @@
+// Copyright 2022-2024 Antmicro <www.antmicro.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "grabthecam/captureloop.hpp"
+#include "grabthecam/cameracapture.hpp"
+
+namespace grabthecam
+{
+
+/// How often the capture thread checks whether it should stop, in milliseconds
+#define CAPTURE_LOOP_POLL_TIMEOUT 100
+
+CaptureLoop::CaptureLoop(CameraCapture &camera, int number_of_buffers)
+    : camera(camera), number_of_buffers(number_of_buffers)
+{
+}
+
+CaptureLoop::~CaptureLoop()
+{
+    running = false;
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+}
+
+void CaptureLoop::start(FrameSink sink, ErrorHandler on_error)
+{
+    camera.startStreaming(number_of_buffers);
+    running = true;
+    thread = std::thread(&CaptureLoop::run, this, sink, on_error);
+}
+
+void CaptureLoop::stop(std::function<void()> drop_pending)
+{
+    if (!thread.joinable())
+    {
+        return;
+    }
+
+    running = false;
+    thread.join();
+
+    // Return the pending buffers before the driver takes all of them back
+    drop_pending();
+    camera.stopStreaming();
+}
+
+void CaptureLoop::run(FrameSink sink, ErrorHandler on_error)
+{
+    while (running)
+    {
+        try
+        {
+            // Wait with a timeout, so the thread notices the stop request even if the camera stalls
+            std::optional<FrameLease> frame = camera.grabFor(std::chrono::milliseconds(CAPTURE_LOOP_POLL_TIMEOUT));
+            if (frame.has_value())
+            {
+                sink(std::move(*frame));
+            }
+        }
+        catch (...)
+        {
+            running = false;
+            on_error(std::current_exception());
+        }
+    }
+}
+
+}; // namespace grabthecam
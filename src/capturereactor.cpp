@@ -0,0 +1,194 @@
+// Copyright 2022-2024 Antmicro <www.antmicro.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "grabthecam/capturereactor.hpp"
+
+#include <iostream>
+
+namespace grabthecam
+{
+
+CaptureReactor::CaptureReactor(unsigned int workers) : workers(workers)
+{
+    for (unsigned int i = 0; i < std::max(workers, 1u); i++)
+    {
+        loops.push_back(std::make_unique<Loop>());
+    }
+}
+
+CaptureReactor::~CaptureReactor()
+{
+    stop();
+}
+
+void CaptureReactor::add(CameraCapture &camera, FrameCallback callback)
+{
+    std::lock_guard<std::mutex> lock(sources_mutex);
+
+    Loop &loop = *loops[next_loop];
+    next_loop = (next_loop + 1) % loops.size();
+
+    loop.sources.push_back(std::make_unique<Source>(Source{&camera, callback}));
+    // POLLPRI signals control events, which keep the camera's control values up to date
+    try
+    {
+        loop.poller.add(camera.getFd(), EPOLLIN | EPOLLPRI, {.ptr = loop.sources.back().get()});
+    }
+    catch (CameraException e)
+    {
+        loop.sources.pop_back();
+        throw CameraException("Could not register the camera in the event loop", e.error_code);
+    }
+}
+
+void CaptureReactor::start()
+{
+    if (workers == 0 || running.exchange(true))
+    {
+        return;
+    }
+
+    for (std::unique_ptr<Loop> &loop : loops)
+    {
+        loop->thread = std::thread(&CaptureReactor::work, this, std::ref(*loop));
+    }
+}
+
+void CaptureReactor::stop()
+{
+    running = false;
+
+    for (std::unique_ptr<Loop> &loop : loops)
+    {
+        if (!loop->poller.wake())
+        {
+            std::cerr << "[WARNING] Could not wake up the event loop\n";
+        }
+    }
+    for (std::unique_ptr<Loop> &loop : loops)
+    {
+        if (loop->thread.joinable())
+        {
+            loop->thread.join();
+        }
+    }
+}
+
+void CaptureReactor::run()
+{
+    if (workers != 0)
+    {
+        throw CameraException("CaptureReactor: run is available only without worker threads");
+    }
+
+    running = true;
+    while (running)
+    {
+        process(*loops[0], -1);
+    }
+}
+
+int CaptureReactor::runOnce(std::chrono::milliseconds timeout)
+{
+    if (workers != 0)
+    {
+        throw CameraException("CaptureReactor: runOnce is available only without worker threads");
+    }
+    return process(*loops[0], timeout.count() < 0 ? -1 : timeout.count());
+}
+
+void CaptureReactor::work(Loop &loop)
+{
+    while (running)
+    {
+        try
+        {
+            process(loop, -1);
+        }
+        catch (std::exception &e)
+        {
+            // Only waiting for the events can fail here, and it would fail again on the next iteration
+            std::cerr << "[WARNING] Event loop error, stopping the worker (Error " << e.what() << ")\n";
+            return;
+        }
+    }
+}
+
+int CaptureReactor::process(Loop &loop, int timeout)
+{
+    epoll_event events[POLLER_MAX_EVENTS];
+    int count = loop.poller.wait(events, timeout);
+
+    int dispatched = 0;
+    for (int i = 0; i < count; i++)
+    {
+        Source *source = static_cast<Source *>(events[i].data.ptr);
+        try
+        {
+            dispatched += dispatch(loop, *source, events[i].events);
+        }
+        catch (std::exception &e)
+        {
+            // A failing camera (e.g. an unplugged one) keeps reporting the events, so it would fail on every wake-up
+            std::cerr << "[WARNING] Camera " << source->camera->getFd() << " failed, removing it from the loop (Error "
+                      << e.what() << ")\n";
+            removeSource(loop, *source);
+        }
+    }
+    return dispatched;
+}
+
+void CaptureReactor::removeSource(Loop &loop, Source &source)
+{
+    loop.poller.remove(source.camera->getFd());
+}
+
+int CaptureReactor::dispatch(Loop &loop, Source &source, uint32_t events)
+{
+    if (events & EPOLLERR)
+    {
+        // The stream was stopped, stop watching the camera instead of spinning on the error
+        std::cerr << "[WARNING] Camera " << source.camera->getFd() << " reported an error, removing it from the loop\n";
+        removeSource(loop, source);
+        return 0;
+    }
+
+    if (events & EPOLLPRI)
+    {
+        source.camera->processControlEvents();
+    }
+    if (!(events & EPOLLIN))
+    {
+        return 0;
+    }
+
+    // A blocking camera would wait in the driver after the ready buffer, so only the non-blocking ones are drained
+    int dispatched = 0;
+    do
+    {
+        int buffer_no = source.camera->tryDequeueBuffer();
+        if (buffer_no < 0)
+        {
+            break;
+        }
+
+        try
+        {
+            source.callback(*source.camera, FrameLease(source.camera, buffer_no));
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "[WARNING] Frame callback failed (Error " << e.what() << ")\n";
+        }
+        catch (...)
+        {
+            std::cerr << "[WARNING] Frame callback failed with an unknown exception\n";
+        }
+        dispatched++;
+    } while (source.camera->isNonBlocking());
+
+    return dispatched;
+}
+
+}; // namespace grabthecam
@@ -0,0 +1,95 @@
+// Copyright 2022-2024 Antmicro <www.antmicro.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "grabthecam/capturethread.hpp"
+
+#include <iostream>
+
+namespace grabthecam
+{
+
+CaptureThread::CaptureThread(CameraCapture &camera, size_t ring_size, int number_of_buffers)
+    : ring(ring_size), loop(camera, number_of_buffers), dropped_frames(0)
+{
+}
+
+CaptureThread::~CaptureThread()
+{
+    try
+    {
+        stop();
+    }
+    catch (CameraException e)
+    {
+        std::cerr << "[WARNING] Could not stop the capture thread (Error " << e.what() << ")\n";
+    }
+}
+
+void CaptureThread::start()
+{
+    if (loop.isRunning())
+    {
+        return;
+    }
+    // A thread which stopped on an error is still joinable, clean it up before spawning a new one
+    stop();
+
+    dropped_frames = 0;
+    failed = false;
+    loop.start(
+        [this](FrameLease frame)
+        {
+            if (!ring.tryPush(frame))
+            {
+                // The frame is dropped and the buffer goes back to the driver with the lease
+                dropped_frames++;
+            }
+        },
+        [this](std::exception_ptr exception)
+        {
+            error = exception;
+            failed = true;
+        });
+}
+
+void CaptureThread::stop()
+{
+    loop.stop(
+        [this]
+        {
+            while (ring.tryPop().has_value())
+            {
+            }
+        });
+}
+
+void CaptureThread::checkError()
+{
+    if (failed)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+std::optional<FrameLease> CaptureThread::tryPop()
+{
+    std::optional<FrameLease> frame = ring.tryPop();
+    if (!frame.has_value())
+    {
+        checkError();
+    }
+    return frame;
+}
+
+std::optional<FrameLease> CaptureThread::pop(std::chrono::milliseconds timeout)
+{
+    std::optional<FrameLease> frame = ring.pop(timeout);
+    if (!frame.has_value())
+    {
+        checkError();
+    }
+    return frame;
+}
+
+}; // namespace grabthecam
@@ -0,0 +1,148 @@
+// Copyright 2022-2024 Antmicro <www.antmicro.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "grabthecam/deviceprofile.hpp"
+#include "grabthecam/utils.hpp"
+
+#include <cstring>
+#include <fstream>
+
+namespace grabthecam
+{
+
+/// Identifies the profile files
+#define PROFILE_MAGIC 0x50435447 // "GTCP"
+
+/// Incremented each time the layout of the profile file changes
+#define PROFILE_VERSION 2
+
+/// Upper bound for the number of entries in a list, protects against corrupted files
+#define PROFILE_MAX_ENTRIES 65536
+
+namespace
+{
+
+template <typename T> void writeValue(std::ofstream &file, const T &value)
+{
+    file.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T> void writeVector(std::ofstream &file, const std::vector<T> &values)
+{
+    writeValue(file, (uint32_t)values.size());
+    file.write(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(T));
+}
+
+template <typename T> bool readValue(std::ifstream &file, T &value)
+{
+    return (bool)file.read(reinterpret_cast<char *>(&value), sizeof(T));
+}
+
+template <typename T> bool readVector(std::ifstream &file, std::vector<T> &values)
+{
+    uint32_t size;
+    if (!readValue(file, size) || size > PROFILE_MAX_ENTRIES)
+    {
+        return false;
+    }
+    values.resize(size);
+    return (bool)file.read(reinterpret_cast<char *>(values.data()), size * sizeof(T));
+}
+
+/**
+ * Sizes of the stored kernel structures, so a file written with different headers is rejected
+ */
+std::vector<uint32_t> structureSizes()
+{
+    return {sizeof(v4l2_capability), sizeof(v4l2_query_ext_ctrl), sizeof(v4l2_querymenu), sizeof(v4l2_fmtdesc),
+            sizeof(v4l2_frmsizeenum), sizeof(v4l2_frmivalenum)};
+}
+
+}; // namespace
+
+void DeviceProfile::save(std::string filename) const
+{
+    createDirectories(filename);
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        throw CameraException("Save profile: Could not open file for writing");
+    }
+
+    writeValue(file, (uint32_t)PROFILE_MAGIC);
+    writeValue(file, (uint32_t)PROFILE_VERSION);
+    writeVector(file, structureSizes());
+    writeValue(file, capability);
+    writeVector(file, controls);
+    writeVector(file, menus);
+    writeValue(file, (uint32_t)formats.size());
+    for (const FormatDescription &format : formats)
+    {
+        writeValue(file, format.format);
+        writeVector(file, format.sizes);
+        for (const std::vector<v4l2_frmivalenum> &intervals : format.intervals)
+        {
+            writeVector(file, intervals);
+        }
+    }
+
+    if (!file)
+    {
+        throw CameraException("Save profile: Could not write the file", errno);
+    }
+}
+
+std::optional<DeviceProfile> DeviceProfile::load(std::string filename, const v4l2_capability &capability)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open())
+    {
+        return std::nullopt;
+    }
+
+    // Check the cheap header fields first, then the identity of the camera
+    uint32_t magic, version;
+    std::vector<uint32_t> sizes;
+    DeviceProfile profile;
+    if (!readValue(file, magic) || magic != PROFILE_MAGIC || !readValue(file, version) || version != PROFILE_VERSION ||
+        !readVector(file, sizes) || sizes != structureSizes() || !readValue(file, profile.capability) ||
+        !sameDevice(profile.capability, capability))
+    {
+        return std::nullopt;
+    }
+
+    uint32_t formats_count;
+    if (!readVector(file, profile.controls) || !readVector(file, profile.menus) || !readValue(file, formats_count) ||
+        formats_count > PROFILE_MAX_ENTRIES)
+    {
+        return std::nullopt;
+    }
+    profile.formats.resize(formats_count);
+    for (FormatDescription &format : profile.formats)
+    {
+        if (!readValue(file, format.format) || !readVector(file, format.sizes))
+        {
+            return std::nullopt;
+        }
+        format.intervals.resize(format.sizes.size());
+        for (std::vector<v4l2_frmivalenum> &intervals : format.intervals)
+        {
+            if (!readVector(file, intervals))
+            {
+                return std::nullopt;
+            }
+        }
+    }
+    return profile;
+}
+
+bool DeviceProfile::sameDevice(const v4l2_capability &first, const v4l2_capability &second)
+{
+    return memcmp(first.driver, second.driver, sizeof(first.driver)) == 0 &&
+           memcmp(first.card, second.card, sizeof(first.card)) == 0 &&
+           memcmp(first.bus_info, second.bus_info, sizeof(first.bus_info)) == 0 && first.version == second.version &&
+           first.capabilities == second.capabilities && first.device_caps == second.device_caps;
+}
+
+}; // namespace grabthecam
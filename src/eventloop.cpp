@@ -0,0 +1,114 @@
+// Copyright 2022-2024 Antmicro <www.antmicro.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "grabthecam/eventloop.hpp"
+#include "grabthecam/utils.hpp"
+
+#include <algorithm>
+#include <cerrno>
+
+namespace grabthecam
+{
+
+EventLoop::~EventLoop()
+{
+    tasks.clear();
+}
+
+void EventLoop::spawn(Task<void> task)
+{
+    ready.push_back(task.handle);
+    tasks.push_back(std::move(task));
+}
+
+void EventLoop::watch(int fd, std::coroutine_handle<> handle)
+{
+    if (waiters.count(fd))
+    {
+        throw CameraException("Another coroutine is already waiting for the descriptor " + std::to_string(fd));
+    }
+
+    // One-shot events keep the descriptor registered, but disabled until it is awaited again
+    epoll_data_t data = {.u64 = (uint64_t)fd};
+    if (std::find(registered.begin(), registered.end(), fd) != registered.end())
+    {
+        poller.modify(fd, EPOLLIN | EPOLLONESHOT, data);
+    }
+    else
+    {
+        poller.add(fd, EPOLLIN | EPOLLONESHOT, data);
+        registered.push_back(fd);
+    }
+    waiters[fd] = handle;
+}
+
+void EventLoop::run()
+{
+    running = true;
+    while (running)
+    {
+        while (!ready.empty())
+        {
+            std::coroutine_handle<> handle = ready.front();
+            ready.pop_front();
+            handle.resume();
+        }
+        collectFinished();
+
+        if (tasks.empty())
+        {
+            break;
+        }
+
+        epoll_event events[POLLER_MAX_EVENTS];
+        int count = poller.wait(events, -1);
+        for (int i = 0; i < count; i++)
+        {
+            int fd = events[i].data.u64;
+            auto waiter = waiters.find(fd);
+            if (waiter != waiters.end())
+            {
+                ready.push_back(waiter->second);
+                waiters.erase(waiter);
+            }
+        }
+    }
+    running = false;
+}
+
+void EventLoop::stop()
+{
+    running = false;
+    if (!poller.wake())
+    {
+        throw CameraException("Could not wake up the event loop", errno);
+    }
+}
+
+void EventLoop::collectFinished()
+{
+    std::exception_ptr error;
+    for (auto task = tasks.begin(); task != tasks.end();)
+    {
+        if (task->done())
+        {
+            if (task->handle.promise().error && !error)
+            {
+                error = task->handle.promise().error;
+            }
+            task = tasks.erase(task);
+        }
+        else
+        {
+            task++;
+        }
+    }
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+}; // namespace grabthecam
@@ -193,19 +193,26 @@ int main(int argc, char const *argv[])
         camera.enableTrigger();
     }
 
-    auto f = [&streamer, conf](cv::Mat foo) { streamer.sendFrame(foo, conf.stream_name); };
     std::signal(SIGINT, appStopHandler);
 
     // CAPTURE FRAMES
     if (camera.hasConverter())
     {
-        cv::Mat processed_frame = camera.capture();
+        // Convert and send the frames in the delivery thread, dropping the old ones if the network is too slow
+        std::shared_ptr<grabthecam::FrameConverter> converter = camera.getConverter();
+        camera.start(
+            [&streamer, &conf, converter](grabthecam::FrameLease frame)
+            {
+                cv::Mat processed_frame = converter->convert(frame.mat(converter->input_format));
+                streamer.sendFrame(processed_frame, conf.stream_name);
+            },
+            grabthecam::BackpressurePolicy::DROP_OLDEST, 1);
+
         while (app_running)
         {
-            std::thread sender(f, processed_frame);
-            processed_frame = camera.capture();
-            sender.join();
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
         }
+        camera.stop();
     }
     else
     {
@@ -0,0 +1,165 @@
+// Copyright 2022-2024 Antmicro <www.antmicro.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "grabthecam/framedispatcher.hpp"
+#include "grabthecam/cameracapture.hpp"
+
+#include <iostream>
+
+namespace grabthecam
+{
+
+FrameDispatcher::FrameDispatcher(CameraCapture &camera, FrameCallback callback, BackpressurePolicy policy,
+                                 size_t queue_size, int number_of_buffers)
+    : callback(callback), policy(policy), queue_size(queue_size), loop(camera, number_of_buffers), dropped_frames(0)
+{
+}
+
+FrameDispatcher::~FrameDispatcher()
+{
+    try
+    {
+        stop();
+    }
+    catch (CameraException e)
+    {
+        std::cerr << "[WARNING] Could not stop the frame dispatcher (Error " << e.what() << ")\n";
+    }
+}
+
+void FrameDispatcher::start()
+{
+    if (running)
+    {
+        return;
+    }
+    // A thread which stopped on an error is still joinable, clean it up before spawning a new one
+    stop();
+
+    dropped_frames = 0;
+    running = true;
+    try
+    {
+        loop.start([this](FrameLease frame) { enqueue(std::move(frame)); },
+                   [this](std::exception_ptr error) { fail(error); });
+    }
+    catch (...)
+    {
+        running = false;
+        throw;
+    }
+    delivery_thread = std::thread(&FrameDispatcher::deliver, this);
+}
+
+void FrameDispatcher::stop()
+{
+    if (!delivery_thread.joinable())
+    {
+        return;
+    }
+
+    // Clear the flag under the lock, so a thread cannot miss the notification between checking and waiting
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        running = false;
+    }
+    frame_available.notify_all();
+    space_available.notify_all();
+
+    loop.stop(
+        [this]
+        {
+            delivery_thread.join();
+            pending.clear();
+        });
+}
+
+void FrameDispatcher::fail(std::exception_ptr error)
+{
+    try
+    {
+        std::rethrow_exception(error);
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "[WARNING] Capturing the frame failed, stopping (Error " << e.what() << ")\n";
+    }
+    catch (...)
+    {
+        std::cerr << "[WARNING] Capturing the frame failed with an unknown exception, stopping\n";
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        running = false;
+    }
+    frame_available.notify_all();
+}
+
+void FrameDispatcher::enqueue(FrameLease frame)
+{
+    // Dropped leases are destroyed outside the lock, since returning a buffer is an ioctl
+    FrameLease dropped;
+    {
+        std::unique_lock<std::mutex> lock(pending_mutex);
+        if (pending.size() >= queue_size)
+        {
+            switch (policy)
+            {
+            case BackpressurePolicy::BLOCK:
+                space_available.wait(lock, [this] { return pending.size() < queue_size || !running; });
+                break;
+            case BackpressurePolicy::DROP_OLDEST:
+                dropped = std::move(pending.front());
+                pending.pop_front();
+                dropped_frames++;
+                break;
+            case BackpressurePolicy::DROP_NEWEST:
+                dropped = std::move(frame);
+                dropped_frames++;
+                break;
+            }
+        }
+
+        if (frame.valid() && running)
+        {
+            pending.push_back(std::move(frame));
+        }
+    }
+    frame_available.notify_one();
+}
+
+void FrameDispatcher::deliver()
+{
+    while (true)
+    {
+        FrameLease frame;
+        {
+            std::unique_lock<std::mutex> lock(pending_mutex);
+            frame_available.wait(lock, [this] { return !pending.empty() || !running; });
+            if (!running)
+            {
+                return;
+            }
+            frame = std::move(pending.front());
+            pending.pop_front();
+        }
+        space_available.notify_one();
+
+        try
+        {
+            callback(std::move(frame));
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "[WARNING] Frame callback failed (Error " << e.what() << ")\n";
+        }
+        catch (...)
+        {
+            std::cerr << "[WARNING] Frame callback failed with an unknown exception\n";
+        }
+    }
+}
+
+}; // namespace grabthecam
@@ -0,0 +1,110 @@
+// Copyright 2022-2024 Antmicro <www.antmicro.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "grabthecam/framelease.hpp"
+#include "grabthecam/cameracapture.hpp"
+
+#include <iostream>
+#include <utility> // std::exchange
+
+namespace grabthecam
+{
+
+FrameLease::FrameLease(CameraCapture *camera, int buffer_no)
+    : camera(camera), buffer_no(buffer_no), generation(camera->stream_generation)
+{
+    frame = camera->buffers[buffer_no];
+
+    // The size of the cv::Mat depends on the format, in which the frame was captured
+    if (frame->bytesused > 0)
+    {
+        std::shared_ptr<cv::Mat> view;
+        camera->read(view, CV_8U, buffer_no);
+        rows = view->rows;
+        cols = view->cols;
+    }
+}
+
+FrameLease::FrameLease(FrameLease &&other) noexcept
+    : camera(std::exchange(other.camera, nullptr)), buffer_no(std::exchange(other.buffer_no, -1)),
+      generation(other.generation), frame(std::move(other.frame)), rows(other.rows), cols(other.cols)
+{
+}
+
+FrameLease &FrameLease::operator=(FrameLease &&other) noexcept
+{
+    if (this != &other)
+    {
+        FrameLease previous(std::move(*this)); // returns the currently owned buffer when going out of scope
+        camera = std::exchange(other.camera, nullptr);
+        buffer_no = std::exchange(other.buffer_no, -1);
+        generation = other.generation;
+        frame = std::move(other.frame);
+        rows = other.rows;
+        cols = other.cols;
+    }
+    return *this;
+}
+
+FrameLease::~FrameLease()
+{
+    try
+    {
+        release();
+    }
+    catch (CameraException e)
+    {
+        std::cerr << "[WARNING] Could not return the buffer " << buffer_no << " to the driver (Error " << e.what()
+                  << ")\n";
+    }
+}
+
+void FrameLease::release()
+{
+    CameraCapture *owner = std::exchange(camera, nullptr);
+    frame.reset();
+
+    // Buffers from the previous stream were already taken back by the driver
+    if (owner != nullptr && owner->isStreaming() && owner->stream_generation == generation)
+    {
+        owner->queueBuffer(buffer_no);
+    }
+}
+
+std::shared_ptr<MMapBuffer> FrameLease::buffer() const
+{
+    if (!valid())
+    {
+        throw CameraException("The frame lease does not own any buffer");
+    }
+    return frame;
+}
+
+int FrameLease::dmabufFd() const
+{
+    std::shared_ptr<MMapBuffer> owned = buffer();
+    // Buffers from the previous stream cannot be exported anymore
+    if (camera->stream_generation != generation)
+    {
+        return owned->dmabuf_fd;
+    }
+    return camera->exportBuffer(*owned, buffer_no);
+}
+
+std::span<uint8_t> FrameLease::data() const
+{
+    std::shared_ptr<MMapBuffer> owned = buffer();
+    return std::span<uint8_t>(static_cast<uint8_t *>(owned->start), owned->bytesused);
+}
+
+cv::Mat FrameLease::mat(int dtype) const
+{
+    if (!valid())
+    {
+        throw CameraException("The frame lease does not own any buffer");
+    }
+    return cv::Mat(rows, cols, dtype, frame->start);
+}
+
+}; // namespace grabthecam
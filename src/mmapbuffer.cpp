@@ -5,23 +5,68 @@
 #include "grabthecam/mmapbuffer.hpp"
 #include "grabthecam/utils.hpp"
 
+#include <cerrno>     // errno
 #include <cstring>    //memset
+#include <libv4l2.h>  // v4l2_mmap
 #include <sys/mman.h> // PROT_READ...
+#include <unistd.h>   // close
 
 namespace grabthecam
 {
 
-MMapBuffer::MMapBuffer(void *location, int size, int fd, int offset) : size(size)
+MMapBuffer::MMapBuffer(void *location, int size, int fd, int offset, BufferOptions options, bool libv4l2)
+    : bytesused(0), size(size), libv4l2(libv4l2)
 {
-    start = mmap(location, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
-    memset(start, 0, size);
+    int flags = MAP_SHARED;
+    if (options.prefault)
+    {
+        flags |= MAP_POPULATE;
+    }
+
+    start = libv4l2 ? v4l2_mmap(location, size, PROT_READ | PROT_WRITE, flags, fd, offset)
+                    : mmap(location, size, PROT_READ | PROT_WRITE, flags, fd, offset);
+    if (start == MAP_FAILED)
+    {
+        throw CameraException("Mmap failed", errno);
+    }
+
+    if (options.lock && mlock(start, size) < 0)
+    {
+        int error_code = errno;
+        unmap();
+        throw CameraException("Locking the buffer in memory failed. See RLIMIT_MEMLOCK.", error_code);
+    }
+
+    if (options.zero)
+    {
+        memset(start, 0, size);
+    }
+}
+
+MMapBuffer::MMapBuffer(void *location, int size) : bytesused(0), start(location), size(size), mapped(false) {}
 
-    if (start == (void *)-1)
+void MMapBuffer::unmap()
+{
+    if (libv4l2)
     {
-        throw CameraException("Mmap failed");
+        v4l2_munmap(start, size);
+    }
+    else
+    {
+        munmap(start, size);
     }
 }
 
-MMapBuffer::~MMapBuffer() { munmap(start, size); }
+MMapBuffer::~MMapBuffer()
+{
+    if (mapped)
+    {
+        unmap();
+    }
+    if (dmabuf_fd >= 0)
+    {
+        close(dmabuf_fd);
+    }
+}
 
 }; // namespace grabthecam
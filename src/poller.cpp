@@ -0,0 +1,105 @@
+// Copyright 2022-2024 Antmicro <www.antmicro.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "grabthecam/poller.hpp"
+#include "grabthecam/utils.hpp"
+
+#include <cerrno>
+#include <sys/eventfd.h> // eventfd
+#include <unistd.h>      // close
+
+namespace grabthecam
+{
+
+/// Value reported with the wake-up events, distinct from any descriptor or pointer registered by the callers
+#define POLLER_WAKE_KEY UINT64_MAX
+
+Poller::Poller()
+{
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epoll_fd < 0 || wake_fd < 0)
+    {
+        int error_code = errno;
+        close(wake_fd);
+        close(epoll_fd);
+        throw CameraException("Could not create the event loop", error_code);
+    }
+
+    epoll_event event = {.events = EPOLLIN, .data = {.u64 = POLLER_WAKE_KEY}};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event) < 0)
+    {
+        int error_code = errno;
+        close(wake_fd);
+        close(epoll_fd);
+        throw CameraException("Could not register the wake-up descriptor", error_code);
+    }
+}
+
+Poller::~Poller()
+{
+    close(wake_fd);
+    close(epoll_fd);
+}
+
+void Poller::add(int fd, uint32_t events, epoll_data_t data)
+{
+    epoll_event event = {.events = events, .data = data};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+    {
+        throw CameraException("Could not watch the descriptor " + std::to_string(fd), errno);
+    }
+}
+
+void Poller::modify(int fd, uint32_t events, epoll_data_t data)
+{
+    epoll_event event = {.events = events, .data = data};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0)
+    {
+        throw CameraException("Could not watch the descriptor " + std::to_string(fd), errno);
+    }
+}
+
+void Poller::remove(int fd)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+int Poller::wait(epoll_event (&events)[POLLER_MAX_EVENTS], int timeout)
+{
+    int count = epoll_wait(epoll_fd, events, POLLER_MAX_EVENTS, timeout);
+    if (count < 0)
+    {
+        if (errno == EINTR)
+        {
+            return 0;
+        }
+        throw CameraException("Waiting for the events failed", errno);
+    }
+
+    // Consume the wake-ups and keep only the events of the watched descriptors
+    int reported = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (events[i].data.u64 == POLLER_WAKE_KEY)
+        {
+            uint64_t wake;
+            while (read(wake_fd, &wake, sizeof(wake)) > 0)
+            {
+            }
+            continue;
+        }
+        events[reported++] = events[i];
+    }
+    return reported;
+}
+
+bool Poller::wake()
+{
+    uint64_t wake = 1;
+    // A full counter already wakes the waiting thread up
+    return write(wake_fd, &wake, sizeof(wake)) >= 0 || errno == EAGAIN;
+}
+
+}; // namespace grabthecam
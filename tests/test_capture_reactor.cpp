@@ -0,0 +1,54 @@
+#include "grabthecam/cameracapture.hpp"
+#include "grabthecam/capturereactor.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+#define FRAMES_PER_CAMERA 30
+#define TIMEOUT_SECONDS 30
+
+// Captures frames from many cameras (e.g. `modprobe vivid n_devs=16`) with a small pool of worker threads
+int main(int argc, char** argv) {
+    if(argc < 2) {
+        std::cout << "Please give one or more video device paths as arguments\n";
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<grabthecam::CameraCapture>> cameras;
+    std::vector<std::atomic<int>> frames(argc - 1);
+    grabthecam::CaptureReactor reactor(2);
+
+    for (int i = 1; i < argc; i++) {
+        cameras.push_back(std::make_unique<grabthecam::CameraCapture>(argv[i], true));
+        cameras.back()->startStreaming(4);
+        std::atomic<int> &counter = frames[i - 1];
+        reactor.add(*cameras.back(), [&counter](grabthecam::CameraCapture &, grabthecam::FrameLease frame) {
+            if (frame.data().empty()) {
+                throw grabthecam::CameraException("Empty frame");
+            }
+            counter++;
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    reactor.start();
+
+    bool done = false;
+    while (!done && std::chrono::steady_clock::now() - start < std::chrono::seconds(TIMEOUT_SECONDS)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        done = true;
+        for (std::atomic<int> &counter : frames) {
+            done = done && counter >= FRAMES_PER_CAMERA;
+        }
+    }
+    reactor.stop();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (size_t i = 0; i < frames.size(); i++) {
+        std::cout << argv[i + 1] << ": " << frames[i] << " frames, " << frames[i] / seconds << " fps\n";
+    }
+    return done ? 0 : 1;
+}
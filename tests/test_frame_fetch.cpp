@@ -14,18 +14,28 @@ int main(int argc, char** argv) {
         return 1;
     }
     grabthecam::CameraCapture camera(argv[1]);
-    for (const auto& entry : grabthecam::formats_info) {
-        camera.setFormat(1280, 720, entry.first);
+    for (const auto& description : camera.getFormats()) {
+        uint32_t pixelformat = description.format.pixelformat;
+        if (grabthecam::formats_info.find(pixelformat) == grabthecam::formats_info.end()) {
+            continue;
+        }
+        camera.setFormat(1280, 720, pixelformat);
         cv::Mat frame = camera.capture();
         char name[5] = {
-            (char)((uint32_t)(entry.first       ) & 0xff),
-            (char)((uint32_t)(entry.first >> 8  ) & 0xff),
-            (char)((uint32_t)(entry.first >> 16 ) & 0xff),
-            (char)((uint32_t)(entry.first >> 24 ) & 0xff),
+            (char)((uint32_t)(pixelformat       ) & 0xff),
+            (char)((uint32_t)(pixelformat >> 8  ) & 0xff),
+            (char)((uint32_t)(pixelformat >> 16 ) & 0xff),
+            (char)((uint32_t)(pixelformat >> 24 ) & 0xff),
             0
         };
         std::string filename = "frame_" + std::string(name) + ".png";
         grabthecam::saveToFile(filename, frame);
     }
+
+    grabthecam::CameraCapture::FormatChoice choice = camera.setBestFormat(640, 480);
+    std::cout << "Cheapest format for 640 x 480: " << choice.width << " x " << choice.height << " (cost "
+              << choice.cost << ")\n";
+    cv::Mat frame = camera.capture();
+    grabthecam::saveToFile("frame_best.png", frame);
     return 0;
 }